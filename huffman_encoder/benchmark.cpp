@@ -0,0 +1,387 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "huffman_encoder.h"
+#include "histogram.h"
+#include "block_coder.h"
+#include "dictionary.h"
+#include "bit_writer.h"
+
+// Throughput of every stage of Huffman coding over the samples and synthetic data, optionally compared with an earlier run
+
+const char* DEFAULT_SAMPLES[] { "samples/lorem.txt", "samples/Warandpeace.txt", "samples/Warandpeace.pdf", "samples/picture.png",
+                                "samples/random.txt" };
+constexpr unsigned DEFAULT_SYNTHETIC_SIZE { 4 * 1024 * 1024 };
+constexpr double DEFAULT_MIN_TIME { 0.5 };     // Seconds every stage is repeated for
+constexpr unsigned MESSAGE_SIZE { 200 };        // Corpora are also cut into messages coded with a dictionary trained on them
+
+struct corpus
+{
+    std::string name;
+    std::vector<char> data;
+};
+
+struct result
+{
+    std::string corpus;
+    std::string stage;
+    unsigned long long size;        // Input bytes of one run
+    unsigned long long iterations;
+    double ns_per_run;
+    double ratio;                   // Compressed size over raw size, header included
+    double cycles_per_run;          // Time stamp counter ticks, zero where there's none
+    unsigned long long bits;        // Coded bits of one run, for stages which only write bits
+};
+
+struct baseline_entry
+{
+    std::string corpus;
+    std::string stage;
+    unsigned long long size;
+    double ns_per_run;
+};
+
+struct bench_options
+{
+    block_options coding { };
+    double min_time { DEFAULT_MIN_TIME };
+    unsigned synthetic_size { DEFAULT_SYNTHETIC_SIZE };
+    const char* json { nullptr };       // "-" for standard output
+    const char* baseline { nullptr };
+};
+
+volatile unsigned long long sink;   // Results are added to it, so stages aren't optimized out
+
+double mb_per_s(const result& r)
+{
+    return r.size / (r.ns_per_run / 1e9) / (1024 * 1024);
+}
+
+double bits_per_cycle(const result& r)
+{
+    return r.cycles_per_run > 0 ? r.bits / r.cycles_per_run : 0;
+}
+
+unsigned long long read_cycles()
+{   // Counter ticks at the nominal frequency, so bits per cycle are of the base clock rather than the boosted one
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+bool read_file(const char* path, std::vector<char>& data)
+{
+    std::ifstream in { path, std::ios::binary };
+    data.assign(std::istreambuf_iterator<char> { in }, std::istreambuf_iterator<char> { });
+    return in.is_open() && !in.bad();
+}
+
+std::vector<corpus> synthetic_corpora(size_t n)
+{   // Seeded, so every run codes the same data
+    std::mt19937 gen { 12345 };
+    std::vector<corpus> res { { "uniform", { } }, { "skewed", { } }, { "text", { } }, { "zeros", std::vector<char>(n) } };
+    std::uniform_int_distribution<int> byte { 0, CHAR_RANGE - 1 };
+    std::geometric_distribution<int> rank { 0.2 };
+    const char* words[] { "the", "of", "and", "to", "a", "in", "that", "he", "was", "his", "it", "with", "had", "prince",
+                          "Pierre", "said", "not", "at", "her", "on", "for", "but", "you", "Natasha", "which", "what" };
+    std::geometric_distribution<int> word { 0.15 };
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        res[0].data.push_back(static_cast<char>(byte(gen)));
+        res[1].data.push_back(static_cast<char>(rank(gen) % CHAR_RANGE));
+    }
+    while (res[2].data.size() < n)
+    {   // Zipf-like choice of words, punctuation now and then
+        const char* w { words[word(gen) % (sizeof(words) / sizeof(words[0]))] };
+        res[2].data.insert(res[2].data.end(), w, w + strlen(w));
+        res[2].data.push_back(gen() % 12 == 0 ? ',' : gen() % 20 == 0 ? '\n' : ' ');
+    }
+    res[2].data.resize(n);
+    return res;
+}
+
+template <typename Run>
+result measure(const corpus& c, const char* stage, double min_time, Run run)
+{   // Repeats the stage until it took `min_time`, at least twice so the first run only warms up
+    using namespace std::chrono;
+    result res { c.name, stage, c.data.size(), 0, 0, 0, 0, 0 };
+    run();
+    const unsigned long long start_cycles { read_cycles() };
+    const auto start { steady_clock::now() };
+    duration<double> elapsed { };
+    do
+    {
+        run();
+        ++res.iterations;
+        elapsed = steady_clock::now() - start;
+    } while (elapsed.count() < min_time);
+    res.ns_per_run = elapsed.count() * 1e9 / res.iterations;
+    res.cycles_per_run = static_cast<double>(read_cycles() - start_cycles) / res.iterations;
+    return res;
+}
+
+bool bench_messages(const corpus& c, const histogram& counts, const bench_options& opt, std::vector<result>& results)
+{   // Messages have no headers, the ratio is of their payloads alone
+    const std::shared_ptr<huffman_dictionary> dict { train_dictionary(counts, 0, opt.coding.max_code_length) };
+    std::vector<std::vector<char>> messages;
+    for (size_t pos = 0; pos < c.data.size(); pos += MESSAGE_SIZE)
+        messages.emplace_back(c.data.begin() + pos, c.data.begin() + std::min(c.data.size(), pos + MESSAGE_SIZE));
+
+    std::vector<std::vector<char>> payloads;
+    results.push_back(measure(c, "msg-encode", opt.min_time, [&]
+    {
+        payloads = compress_batch(*dict, messages);
+        sink = sink + payloads.size();
+    }));
+    std::vector<std::vector<char>> decoded;
+    results.push_back(measure(c, "msg-decode", opt.min_time, [&]
+    {
+        decoded = decompress_batch(*dict, payloads);
+        sink = sink + decoded.size();
+    }));
+    unsigned long long size { };
+    for (const std::vector<char>& p : payloads)
+        size += p.size();
+    results[results.size() - 2].ratio = results.back().ratio = static_cast<double>(size) / c.data.size();
+    return decoded == messages;
+}
+
+bool bench_corpus(const corpus& c, const bench_options& opt, std::vector<result>& results)
+{   // False if the decoded data differ from the input
+    const char* data { c.data.data() };
+    const size_t n { c.data.size() };
+    histogram counts { };
+    huffman_encoder table { };
+    encoded_block block { };
+
+    auto build = [&]
+    {
+        table.set_code_length_limit(opt.coding.max_code_length);
+        table.init_for_compressing();
+        table.add_counts(counts);
+        table.encode();
+    };
+    results.push_back(measure(c, "histogram", opt.min_time, [&]
+    {
+        counts.clear();
+        counts.add(data, n);
+        sink = sink + counts.counts[0];
+    }));
+    results.push_back(measure(c, "tree", opt.min_time, [&]
+    {
+        build();
+        sink = sink + table.code_length_of(data[0]);
+    }));
+    results.push_back(measure(c, "encode", opt.min_time, [&]
+    {
+        block = encode_huffman(data, n, table, true, true, opt.coding);
+        sink = sink + block.payload.size();
+    }));
+    std::vector<char> coded(table.payload_size() + BIT_WRITER_SLACK);
+    results.push_back(measure(c, "bit-writer", opt.min_time, [&]
+    {   // Codes of the table alone, without the block around them
+        bit_writer writer { coded.data(), coded.size() };
+        table.encode_block(reinterpret_cast<const uint8_t*>(data), n, writer);
+        sink = sink + writer.finish();
+    }));
+    results.back().bits = table.payload_bits(data, n);
+    std::vector<char> decoded;
+    results.push_back(measure(c, "decode", opt.min_time, [&]
+    {
+        decoded.resize(n);
+        decode_block(table, block.payload.data(), block.payload.size(), n, opt.coding.interleave, opt.coding, decoded.data());
+        sink = sink + decoded.size();
+    }));
+    const double ratio { static_cast<double>(block.header.size() + block.payload.size()) / n };
+    for (size_t i = results.size() - 5; i < results.size(); ++i)
+        results[i].ratio = ratio;
+    return decoded == c.data && bench_messages(c, counts, opt, results);
+}
+
+std::string json_string(const std::string& s)
+{
+    std::string res { "\"" };
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            res.push_back('\\');
+        if (static_cast<unsigned char>(c) >= ' ')
+            res.push_back(c);
+    }
+    return res + "\"";
+}
+
+void write_json(FILE* f, const std::vector<result>& results, const bench_options& opt)
+{   // One result per line, so runs can be compared by line tools as well as by --baseline
+    fprintf(f, "{\n  \"context\": { \"min_time\": %g, \"max_code_length\": %u, \"interleave\": %s },\n  \"benchmarks\": [\n",
+            opt.min_time, opt.coding.max_code_length, opt.coding.interleave ? "true" : "false");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const result& r { results[i] };
+        fprintf(f, "    { \"corpus\": %s, \"stage\": %s, \"size\": %llu, \"iterations\": %llu, \"ns_per_run\": %.0f, "
+                   "\"mb_per_s\": %.2f, \"ratio\": %.4f, \"bits_per_cycle\": %.3f }%s\n",
+                json_string(r.corpus).c_str(), json_string(r.stage).c_str(), r.size, r.iterations, r.ns_per_run, mb_per_s(r),
+                r.ratio, bits_per_cycle(r), i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+bool json_field(const std::string& line, const char* key, std::string& value)
+{   // Reads fields of the lines written by write_json, not JSON in general
+    const std::string quoted { std::string { "\"" } + key + "\": " };
+    const size_t pos { line.find(quoted) };
+    if (pos == std::string::npos)
+        return false;
+    const size_t start { pos + quoted.size() };
+    if (line[start] == '"')
+        value = line.substr(start + 1, line.find('"', start + 1) - start - 1);
+    else
+        value = line.substr(start, line.find_first_of(",}", start) - start);
+    return true;
+}
+
+bool read_baseline(const char* path, std::vector<baseline_entry>& entries)
+{
+    std::ifstream in { path };
+    if (!in)
+        return false;
+    for (std::string line; std::getline(in, line);)
+    {
+        baseline_entry e { };
+        std::string size;
+        std::string ns;
+        if (json_field(line, "corpus", e.corpus) && json_field(line, "stage", e.stage) && json_field(line, "size", size)
+            && json_field(line, "ns_per_run", ns))
+        {
+            e.size = strtoull(size.c_str(), nullptr, 10);
+            e.ns_per_run = strtod(ns.c_str(), nullptr);
+            entries.push_back(e);
+        }
+    }
+    return true;
+}
+
+void print_results(FILE* f, const std::vector<result>& results, const std::vector<baseline_entry>& baseline)
+{   // Change is of the throughput, positive when this run is faster; only runs over the same data are compared
+    fprintf(f, "%-16s %-10s %12s %12s %10s %8s %9s%s\n", "corpus", "stage", "bytes", "us/run", "MB/s", "ratio", "bits/cyc",
+            baseline.empty() ? "" : "   change");
+    for (const result& r : results)
+    {
+        fprintf(f, "%-16s %-10s %12llu %12.1f %10.1f %8.4f", r.corpus.c_str(), r.stage.c_str(), r.size, r.ns_per_run / 1000,
+                mb_per_s(r), r.ratio);
+        if (bits_per_cycle(r) > 0)
+            fprintf(f, " %9.3f", bits_per_cycle(r));
+        else
+            fprintf(f, " %9s", "-");
+        for (const baseline_entry& e : baseline)
+            if (e.corpus == r.corpus && e.stage == r.stage && e.size == r.size && r.ns_per_run > 0)
+                fprintf(f, " %+8.1f%%", (e.ns_per_run / r.ns_per_run - 1) * 100);
+        fprintf(f, "\n");
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    std::vector<const char*> files;
+    bench_options opt { };
+    bool bad_option { false };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strncmp(argv[i], "--min-time=", 11) == 0)
+            opt.min_time = strtod(argv[i] + 11, nullptr);
+        else if (strncmp(argv[i], "--size=", 7) == 0)
+            opt.synthetic_size = strtoul(argv[i] + 7, nullptr, 10) * 1024;
+        else if (strncmp(argv[i], "--max-code-length=", 18) == 0)
+            opt.coding.max_code_length = strtoul(argv[i] + 18, nullptr, 10);
+        else if (strcmp(argv[i], "--interleave") == 0)
+            opt.coding.interleave = true;
+        else if (strncmp(argv[i], "--json=", 7) == 0)
+            opt.json = argv[i] + 7;
+        else if (strncmp(argv[i], "--baseline=", 11) == 0)
+            opt.baseline = argv[i] + 11;
+        else if (strncmp(argv[i], "--", 2) == 0)
+            bad_option = true;
+        else
+            files.push_back(argv[i]);
+    }
+    bad_option |= !(opt.min_time > 0) || opt.synthetic_size == 0 || opt.synthetic_size > BUFFER_SIZE;
+    bad_option |= opt.coding.max_code_length == 0 || opt.coding.max_code_length > MAX_CODE_LENGTH;
+
+    if (bad_option)
+    {
+        printf("Usage: %s [options] [files=samples]\n", argv[0]);
+        printf("Options:\n"
+               "  --min-time=S           repeat every stage for S seconds, %g by default\n"
+               "  --size=K               size of synthetic data in KiB, %u by default\n"
+               "  --max-code-length=N    limit Huffman codes to N bits, 1 to %u\n"
+               "  --interleave           code blocks as %u streams decoded together\n"
+               "  --json=FILE            write results as JSON, \"-\" for standard output\n"
+               "  --baseline=FILE        show the change of throughput against JSON of an earlier run\n",
+               DEFAULT_MIN_TIME, DEFAULT_SYNTHETIC_SIZE / 1024, MAX_CODE_LENGTH, STREAM_COUNT);
+        return 1;
+    }
+    if (files.empty())
+        files.assign(std::begin(DEFAULT_SAMPLES), std::end(DEFAULT_SAMPLES));
+
+    std::vector<corpus> corpora;
+    for (const char* path : files)
+    {
+        corpus c { strrchr(path, '/') != nullptr ? strrchr(path, '/') + 1 : path, { } };
+        if (!read_file(path, c.data))
+        {
+            fprintf(stderr, "Can't read %s\n", path);
+            return 2;
+        }
+        corpora.push_back(c);
+    }
+    for (corpus& c : synthetic_corpora(opt.synthetic_size))
+        corpora.push_back(c);
+
+    std::vector<baseline_entry> baseline;
+    if (opt.baseline != nullptr && !read_baseline(opt.baseline, baseline))
+    {
+        fprintf(stderr, "Can't read %s\n", opt.baseline);
+        return 2;
+    }
+
+    std::vector<result> results;
+    for (const corpus& c : corpora)
+    {   // Empty data take no time to code
+        if (c.data.empty())
+            continue;
+        if (!bench_corpus(c, opt, results))
+        {
+            fprintf(stderr, "Decoding %s gave different data\n", c.name.c_str());
+            return 3;
+        }
+    }
+    print_results(opt.json != nullptr && strcmp(opt.json, "-") == 0 ? stderr : stdout, results, baseline);
+
+    if (opt.json != nullptr)
+    {
+        FILE* f { strcmp(opt.json, "-") == 0 ? stdout : fopen(opt.json, "w") };
+        if (f == nullptr)
+        {
+            fprintf(stderr, "Can't write %s\n", opt.json);
+            return 2;
+        }
+        write_json(f, results, opt);
+        if (f != stdout)
+            fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef BIT_READER_H
+#define BIT_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+inline uint64_t load_big_endian(const char* p)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t res;
+    memcpy(&res, p, sizeof(res));
+    return __builtin_bswap64(res);
+#else
+    uint64_t res { };
+    for (unsigned i = 0; i < sizeof(res); ++i)
+        res = (res << 8) | static_cast<unsigned char>(p[i]);
+    return res;
+#endif
+}
+
+struct bit_reader   // Reads bits most significant first, as bit_writer writes them
+{
+    bit_reader(const char* data, size_t n)
+    : data { data }, length { n } { };
+
+    uint64_t peek() const   // At least 57 next bits at the top, zeroes past the end of the data
+    {
+        const size_t byte { static_cast<size_t>(position / 8) };
+        if (byte + sizeof(uint64_t) <= length)
+            return load_big_endian(data + byte) << (position % 8);
+        uint64_t res { };
+        for (size_t i = byte; i < byte + sizeof(res); ++i)
+            res = (res << 8) | (i < length ? static_cast<unsigned char>(data[i]) : 0);
+        return res << (position % 8);
+    }
+
+    uint32_t read(unsigned bits)    // Mustn't read more than 32 bits
+    {
+        const uint64_t window { peek() };
+        position += bits;
+        return static_cast<uint32_t>((window >> 1) >> (63 - bits));
+    }
+
+    size_t size() const { return length; }
+
+    unsigned long long position { };   // Bits consumed
+
+private:
+    const char* data;
+    size_t length;
+};
+
+#endif // BIT_READER_H
@@ -0,0 +1,66 @@
+#ifndef BIT_WRITER_H
+#define BIT_WRITER_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+inline void store_big_endian(char* p, uint64_t value)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap64(value);
+    memcpy(p, &value, sizeof(value));
+#else
+    for (unsigned i = sizeof(value); i-- > 0; value >>= 8)
+        p[i] = static_cast<char>(value);
+#endif
+}
+
+constexpr size_t BIT_WRITER_SLACK { sizeof(uint64_t) };   // Buffers hold the coded bytes and this many more
+
+struct bit_writer   // Writes codes most significant bit first, as the decoder reads them
+{
+    bit_writer(char* out, size_t capacity)
+    : begin { out }, pos { out }, end { out + capacity } { };
+
+    void put(uint32_t code, unsigned length)    // Length mustn't exceed 32 bits
+    {
+        acc = (acc << length) | code;
+        count += length;
+        if (count >= 32)
+            flush();
+    }
+
+    size_t size() const { return pos - begin; }     // Complete bytes written since the last rewind
+
+    void rewind() { pos = begin; }                  // Written bytes were consumed, pending bits are kept
+
+    size_t finish()     // Pads the last byte with zeroes
+    {
+        for (; count >= 8; count -= 8)
+            *pos++ = static_cast<char>(acc >> (count - 8));
+        if (count > 0)
+            *pos++ = static_cast<char>(acc << (8 - count));
+        count = 0;
+        return size();
+    }
+
+private:
+    void flush()
+    {   // Whole accumulator is stored and the position moves by the complete bytes, the rest is overwritten later.
+        // The slack callers reserve past the coded bytes keeps the store within the capacity
+        assert(end - pos >= static_cast<ptrdiff_t>(BIT_WRITER_SLACK));
+        store_big_endian(pos, acc << (64 - count));
+        pos += count / 8;
+        count %= 8;
+    }
+
+    char* begin;
+    char* pos;
+    char* end;
+    uint64_t acc { };
+    unsigned count { };     // Pending bits in the lowest bits of `acc`, fewer than 32 between codes
+};
+
+#endif // BIT_WRITER_H
@@ -0,0 +1,436 @@
+#include <algorithm>
+#include <stdexcept>
+#include "block_coder.h"
+#include "bit_writer.h"
+#include "crc32c.h"
+
+namespace
+{
+    template <typename Table>
+    std::vector<char> code_payload(const Table& table, const char* data, size_t n)
+    {
+        std::vector<char> res(Table::max_payload_size(n));
+        res.resize(table.encode_block(reinterpret_cast<const uint8_t*>(data), n, res.data()));
+        return res;
+    }
+
+    template <typename Table>
+    encoded_block encode_stateful(const char* data, size_t n, const Table& table, unsigned char type, const block_options& opt)
+    {   // State of these coders carries over from symbol to symbol, their checkpoints only keep the index regular
+        encoded_block res { };
+        res.raw_size = n;
+        res.checksum = crc32c(data, n);
+        res.checkpoints.resize(checkpoint_count(n, opt));
+        res.payload = code_payload(table, data, n);
+        res.header = block_header(type, res.raw_size, res.payload.size(), res.checksum, &table);
+        return res;
+    }
+}
+
+std::vector<unsigned long long> stream_sizes(const huffman_encoder& encoder, const char* data, size_t n, bool counted,
+                                             const block_options& opt)
+{   // Table built from exactly these data (`counted`) knows the size of a single stream without a pass over them
+    if (!opt.interleave)
+        return { counted ? encoder.payload_size() : encoder.payload_size(data, n) };
+    std::vector<unsigned long long> res;
+    const size_t part { static_cast<size_t>(stream_part(n)) };
+    for (unsigned s = 0; s < STREAM_COUNT; ++s)
+    {
+        const size_t begin { std::min<size_t>(n, s * part) };
+        res.push_back(encoder.payload_size(data + begin, std::min(part, n - begin)));
+    }
+    return res;
+}
+
+std::string jump_table(const std::vector<unsigned long long>& sizes)
+{   // Sizes of all streams but the last one, nothing for a single stream
+    std::ostringstream res;
+    for (size_t s = 0; s + 1 < sizes.size(); ++s)
+        write_varint(res, sizes[s]);
+    return res.str();
+}
+
+unsigned long long coded_size(const std::vector<unsigned long long>& sizes)
+{
+    unsigned long long res { jump_table(sizes).size() };
+    for (auto size : sizes) { res += size; }
+    return res;
+}
+
+char* code_streams(const huffman_encoder& encoder, const char* data, size_t n, const std::vector<unsigned long long>& sizes, char* out)
+{   // `out` must fit coded_size(sizes) bytes and the slack of the writer
+    const std::string jump { jump_table(sizes) };
+    const size_t part { static_cast<size_t>(sizes.size() > 1 ? stream_part(n) : n) };
+    char* const end { out + coded_size(sizes) + BIT_WRITER_SLACK };    // Writer may store past its stream, the next one overwrites those bytes
+    out = std::copy(jump.begin(), jump.end(), out);
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        const size_t begin { std::min(n, s * part) };
+        bit_writer writer { out, static_cast<size_t>(end - out) };
+        encoder.encode_block(reinterpret_cast<const uint8_t*>(data + begin), std::min(part, n - begin), writer);
+        out += writer.finish();
+    }
+    return out;
+}
+
+std::vector<unsigned long long> find_checkpoints(const huffman_encoder& encoder, const char* data, size_t n,
+                                                 const std::vector<unsigned long long>& sizes, const block_options& opt)
+{   // Codes are whole at multiples of the interval, so the bit offset in the payload is the only state to keep
+    std::vector<unsigned long long> res;
+    const size_t part { static_cast<size_t>(sizes.size() > 1 ? stream_part(n) : n) };
+    unsigned long long stream_start { jump_table(sizes).size() * CHAR_DIGITS };
+    unsigned long long bits { stream_start };
+    size_t s { }, done { };
+    for (size_t i = opt.checkpoint_interval; opt.checkpoint_interval > 0 && i < n; i += opt.checkpoint_interval)
+    {
+        for (; i >= (s + 1) * part; ++s)
+        {   // Checkpoint is in one of the next streams
+            stream_start += sizes[s] * CHAR_DIGITS;
+            bits = stream_start;
+            done = (s + 1) * part;
+        }
+        bits += encoder.payload_bits(data + done, i - done);
+        done = i;
+        res.push_back(bits);
+    }
+    return res;
+}
+
+size_t checkpoint_count(size_t n, const block_options& opt)
+{
+    return opt.checkpoint_interval > 0 && n > 0 ? (n - 1) / opt.checkpoint_interval : 0;
+}
+
+block_tables build_tables(const char* data, size_t n, const block_options& opt)
+{   // Sizes of tables count too, they are comparable to payloads of small blocks
+    block_tables res { };
+    res.counts.add(data, n);
+    res.huffman = std::make_shared<huffman_encoder>();
+    res.huffman->set_code_length_limit(opt.max_code_length);
+    res.huffman->init_for_compressing();
+    res.huffman->add_counts(res.counts);
+    res.huffman->encode();
+    res.estimated_size = table_size(*res.huffman) + res.huffman->payload_size();
+    if (opt.coder == CODER_TANS || opt.coder == CODER_SMALLEST)
+    {
+        res.tans = std::make_shared<tans_encoder>();
+        res.tans->build(res.counts);
+        const unsigned long long size { table_size(*res.tans) + res.tans->estimated_size() };
+        if (opt.coder == CODER_SMALLEST && size >= res.estimated_size)
+            res.tans.reset();
+        else
+            res.estimated_size = size;
+    }
+    if (opt.coder == CODER_CONTEXT || opt.coder == CODER_SMALLEST)
+    {
+        res.context = std::make_shared<context_model>();
+        res.context->build(data, n, opt.max_code_length);
+        const unsigned long long size { table_size(*res.context) + res.context->estimated_size() };
+        if (opt.coder == CODER_SMALLEST && size >= res.estimated_size)
+        {
+            res.context.reset();
+        }
+        else
+        {
+            res.estimated_size = size;
+            res.tans.reset();
+        }
+    }
+    return res;
+}
+
+encoded_block encode_huffman(const char* data, size_t n, const huffman_encoder& table, bool counted, bool with_table,
+                             const block_options& opt)
+{   // Table is only read, so blocks can be encoded concurrently
+    encoded_block res { };
+    const std::vector<unsigned long long> sizes { stream_sizes(table, data, n, counted, opt) };
+
+    res.raw_size = n;
+    res.checksum = crc32c(data, n);
+    res.checkpoints = find_checkpoints(table, data, n, sizes, opt);
+    res.payload.resize(coded_size(sizes) + BIT_WRITER_SLACK);
+    res.payload.resize(code_streams(table, data, n, sizes, res.payload.data()) - res.payload.data());
+    res.header = block_header((with_table ? BLOCK_HUFFMAN : BLOCK_REUSE) | (opt.interleave ? BLOCK_INTERLEAVED : 0),
+                              res.raw_size, res.payload.size(), res.checksum, with_table ? &table : nullptr);
+    return res;
+}
+
+encoded_block encode_stored(const char* data, size_t n, const block_options& opt)
+{
+    encoded_block res { };
+    res.raw_size = n;
+    res.checksum = crc32c(data, n);
+    res.checkpoints.resize(checkpoint_count(n, opt));
+    res.payload.assign(data, data + n);
+    res.header = block_header<huffman_encoder>(BLOCK_STORED, res.raw_size, res.payload.size(), res.checksum, nullptr);
+    return res;
+}
+
+encoded_block encode_with_tables(const char* data, size_t n, const block_tables& tables, const block_options& opt)
+{
+    if (tables.tans)
+        return encode_stateful(data, n, *tables.tans, BLOCK_TANS, opt);
+    if (tables.context)
+        return encode_stateful(data, n, *tables.context, BLOCK_CONTEXT, opt);
+    return encode_huffman(data, n, *tables.huffman, true, true, opt);
+}
+
+encoded_block encode_lz77(const char* data, size_t n, const block_options& opt)
+{   // Blocks which matches don't make smaller are stored
+    encoded_block res { };
+    res.payload = lz77_encode(data, n, opt.lz77_level, opt.window, opt.max_code_length);
+    if (res.payload.size() >= n)
+        return encode_stored(data, n, opt);
+    res.raw_size = n;
+    res.checksum = crc32c(data, n);
+    res.checkpoints.resize(checkpoint_count(n, opt));
+    res.header = block_header<huffman_encoder>(BLOCK_LZ77, res.raw_size, res.payload.size(), res.checksum, nullptr);
+    return res;
+}
+
+encoded_block encode_block(const char* data, size_t n, const huffman_encoder* shared, bool with_table, const block_options& opt)
+{   // Blocks with their own tables are never larger than stored ones, which compress_bound relies on
+    if (opt.lz77_level > 0)
+        return encode_lz77(data, n, opt);
+    if (shared != nullptr)
+        return encode_huffman(data, n, *shared, false, with_table, opt);
+    const block_tables tables { build_tables(data, n, opt) };
+    if (tables.estimated_size >= n)
+        return encode_stored(data, n, opt);
+    encoded_block res { encode_with_tables(data, n, tables, opt) };
+    if (res.header.size() + res.payload.size() > stored_block_size(n))     // Estimates leave out jump tables
+        return encode_stored(data, n, opt);
+    return res;
+}
+
+encoded_block encode_block(const std::vector<char>& data, const huffman_encoder* shared, bool with_table, const block_options& opt)
+{
+    return encode_block(data.data(), data.size(), shared, with_table, opt);
+}
+
+bool valid_options(const block_options& opt)
+{
+    return opt.max_code_length > 0 && opt.max_code_length <= MAX_CODE_LENGTH && opt.checkpoint_interval <= BUFFER_SIZE
+           && opt.lz77_level <= LZ77_MAX_LEVEL && opt.window > 0 && opt.window <= BUFFER_SIZE
+           && (opt.lz77_level == 0 || (!opt.interleave && opt.coder == CODER_HUFFMAN));
+}
+
+size_t stored_block_size(size_t n)
+{
+    return 1 + varint_size(n) * 2 + CHECKSUM_SIZE + n;
+}
+
+size_t encode_block_to(const char* data, size_t n, const block_options& opt, char* out, size_t capacity, block_record& record)
+{   // Stored and Huffman blocks are written in place, payloads of the other coders are built first
+    const size_t stored { stored_block_size(n) };
+    auto put = [&](const std::string& header, const char* payload, size_t payload_size, uint32_t checksum)
+    {
+        if (header.size() + payload_size > capacity)
+            return size_t { 0 };
+        std::copy(header.begin(), header.end(), out);
+        std::copy(payload, payload + payload_size, out + header.size());
+        record.packed_size = header.size() + payload_size;
+        record.raw_size = n;
+        record.checksum = checksum;
+        return header.size() + payload_size;
+    };
+    auto put_stored = [&]
+    {
+        const uint32_t checksum { crc32c(data, n) };
+        record.checkpoints.assign(checkpoint_count(n, opt), 0);
+        return put(block_header<huffman_encoder>(BLOCK_STORED, n, n, checksum, nullptr), data, n, checksum);
+    };
+    auto put_block = [&](const encoded_block& block)
+    {
+        if (block.header.size() + block.payload.size() > stored)
+            return put_stored();
+        record.checkpoints = block.checkpoints;
+        return put(block.header, block.payload.data(), block.payload.size(), block.checksum);
+    };
+
+    if (opt.lz77_level > 0)
+        return put_block(encode_lz77(data, n, opt));
+    const block_tables tables { build_tables(data, n, opt) };
+    if (tables.estimated_size >= n)
+        return put_stored();
+    if (tables.tans || tables.context)
+        return put_block(encode_with_tables(data, n, tables, opt));
+
+    const huffman_encoder& table { *tables.huffman };
+    const std::vector<unsigned long long> sizes { stream_sizes(table, data, n, true, opt) };
+    const unsigned long long payload_size { coded_size(sizes) };
+    const uint32_t checksum { crc32c(data, n) };
+    const std::string header { block_header(BLOCK_HUFFMAN | (opt.interleave ? BLOCK_INTERLEAVED : 0), n, payload_size, checksum, &table) };
+    if (header.size() + payload_size > stored)
+        return put_stored();
+    if (header.size() + payload_size + BIT_WRITER_SLACK > capacity)
+        return put_block(encode_huffman(data, n, table, true, true, opt));     // No room for the slack of the writer
+    out = std::copy(header.begin(), header.end(), out);
+    code_streams(table, data, n, sizes, out);
+    record.packed_size = header.size() + payload_size;
+    record.raw_size = n;
+    record.checksum = checksum;
+    record.checkpoints = find_checkpoints(table, data, n, sizes, opt);
+    return record.packed_size;
+}
+
+block_choice choose_block(const block_tables& tables, const huffman_encoder* previous, size_t n)
+{   // Sizes are estimated from the histogram, the data aren't coded to compare them
+    const unsigned long long reused { previous != nullptr ? previous->payload_size(tables.counts) : ULLONG_MAX };
+    if (n <= std::min(tables.estimated_size, reused))
+        return CHOICE_STORED;
+    return reused <= tables.estimated_size ? CHOICE_REUSE : CHOICE_NEW_TABLE;
+}
+
+uint32_t chain_checksum(uint32_t crc, uint32_t block_checksum)
+{   // Checksum of the file covers checksums of blocks as they are stored
+    std::ostringstream bytes;
+    write_checksum(bytes, block_checksum);
+    return crc32c(bytes.str().data(), CHECKSUM_SIZE, crc);
+}
+
+std::string end_block(const std::vector<block_record>& blocks, unsigned long long checkpoint_interval)
+{   // End block is followed by the checksum of the file, the index of blocks and its offset
+    std::ostringstream end;
+    unsigned long long index_offset { MAGIC_SIZE + 1 + CHECKSUM_SIZE };
+    uint32_t checksum { };
+    for (auto& b : blocks)
+    {
+        index_offset += b.packed_size;
+        checksum = chain_checksum(checksum, b.checksum);
+    }
+    end.put(BLOCK_END | BLOCK_CHECKSUM);
+    write_checksum(end, checksum);
+    write_varint(end, blocks.size());
+    write_varint(end, checkpoint_interval);
+    for (auto& b : blocks)
+    {
+        write_varint(end, b.packed_size);
+        write_varint(end, b.raw_size);
+        for (size_t i = 0; i < b.checkpoints.size(); ++i)
+            write_varint(end, b.checkpoints[i] - (i > 0 ? b.checkpoints[i - 1] : 0));
+    }
+    write_index_offset(end, index_offset);
+    return end.str();
+}
+
+void decode_block(const huffman_encoder& table, const char* payload, size_t payload_size, unsigned long long raw_size,
+                  bool interleaved, const block_options& opt, char* out)
+{
+    huffman_encoder decoder { };
+    const char* streams[STREAM_COUNT] { payload };
+    size_t sizes[STREAM_COUNT] { payload_size };
+
+    decoder.copy_table(table);      // Lookup of the table comes along if it was built
+    if (interleaved && !split_streams(payload, payload_size, streams, sizes))
+        throw std::runtime_error { "Jump table is corrupted" };
+    if (!opt.use_automaton)
+    {
+        decoder.build_lookup();
+        if (interleaved)
+        {
+            decoder.decompress_streams(streams, sizes, out, raw_size);
+            return;
+        }
+        decoder.init_for_decompressing(raw_size);
+        decoder.decompress_block(payload, payload_size, out, raw_size);
+        if (!decoder.finished())
+            throw std::runtime_error { "Block is truncated" };
+        return;
+    }
+    const unsigned long long part { interleaved ? stream_part(raw_size) : raw_size };
+    size_t pos { };
+    for (unsigned s = 0; s < (interleaved ? STREAM_COUNT : 1); ++s)
+    {   // Streams are decoded bit by bit one after another
+        decoder.init_for_decompressing(std::min(part, raw_size - std::min<unsigned long long>(raw_size, s * part)));
+        for (size_t i = 0; i < sizes[s]; ++i)
+        {
+            for (char c : decoder.decompress_iteration(streams[s][i])) { out[pos++] = c; }
+        }
+        if (!decoder.finished())
+            throw std::runtime_error { "Block is truncated" };
+    }
+}
+
+void decode_tans_block(tans_encoder& decoder, const char* payload, size_t payload_size, unsigned long long raw_size, char* out)
+{
+    decoder.init_for_decompressing(payload, payload_size);
+    decoder.decompress_block(out, raw_size);
+    if (!decoder.finished())
+        throw std::runtime_error { "Block is corrupted" };
+}
+
+void decode_context_block(const context_model& model, const char* payload, size_t payload_size, unsigned long long raw_size, char* out)
+{
+    if (!model.decompress_block(payload, payload_size, out, raw_size))
+        throw std::runtime_error { "Block is corrupted" };
+}
+
+void decode_lz77_block(const char* payload, size_t payload_size, unsigned long long raw_size, char* out)
+{
+    if (!lz77_decode(payload, payload_size, out, raw_size))
+        throw std::runtime_error { "Block is corrupted" };
+}
+
+bool read_block_header(std::istream& is, block_info& block, decoder_tables& tables)
+{   // Sizes are checked before anything is allocated, so corrupted ones can't make the decoder allocate far more than it read
+    const int type { is.get() };
+    if (type == std::istream::traits_type::eof())
+        return false;
+    block.type = type & ~(BLOCK_INTERLEAVED | BLOCK_CHECKSUM);
+    block.interleaved = (type & BLOCK_INTERLEAVED) != 0;
+    block.checksummed = (type & BLOCK_CHECKSUM) != 0;
+    block.checksum = 0;
+    block.raw_size = block.payload_size = 0;
+    if (block.type == BLOCK_END)
+        return !block.interleaved && (!block.checksummed || read_checksum(is, block.checksum));
+    if (!read_varint(is, block.raw_size) || !read_varint(is, block.payload_size) || (block.checksummed && !read_checksum(is, block.checksum)))
+        return false;
+    if (block.raw_size > BUFFER_SIZE)   // No encoder makes larger blocks
+        return false;
+    if (block.type == BLOCK_TANS && !block.interleaved)
+    {   // Symbols may take less than a bit, so the raw size isn't bounded by the payload
+        tables.tans = std::make_shared<tans_encoder>();
+        return tables.tans->read_table(is);
+    }
+    if (block.type == BLOCK_LZ77)   // Matches may repeat far more than their payload
+        return !block.interleaved;
+    if (block.type == BLOCK_STORED ? block.interleaved || block.raw_size != block.payload_size
+                                   : block.raw_size > block.payload_size * CHAR_DIGITS)
+        return false;
+    if (block.type == BLOCK_HUFFMAN)
+    {   // Lookup is built once, blocks reusing the table share it
+        tables.huffman = std::make_shared<huffman_encoder>();
+        if (!tables.huffman->read_table(is))
+            return false;
+        tables.huffman->build_lookup();
+        return true;
+    }
+    if (block.type == BLOCK_CONTEXT && !block.interleaved)
+    {
+        tables.context = std::make_shared<context_model>();
+        return tables.context->read_table(is);
+    }
+    return block.type == BLOCK_STORED || (block.type == BLOCK_REUSE && tables.huffman);
+}
+
+void decode_payload(const block_info& block, const decoder_tables& tables, const char* payload, const block_options& opt, char* out)
+{   // Throws for data which can't be decoded
+    if (block.type == BLOCK_STORED)
+        std::copy(payload, payload + block.payload_size, out);
+    else if (block.type == BLOCK_TANS)
+        decode_tans_block(*tables.tans, payload, block.payload_size, block.raw_size, out);
+    else if (block.type == BLOCK_CONTEXT)
+        decode_context_block(*tables.context, payload, block.payload_size, block.raw_size, out);
+    else if (block.type == BLOCK_LZ77)
+        decode_lz77_block(payload, block.payload_size, block.raw_size, out);
+    else
+        decode_block(*tables.huffman, payload, block.payload_size, block.raw_size, block.interleaved, opt, out);
+}
+
+std::vector<char> decode_payload(const block_info& block, const decoder_tables& tables, const char* payload, const block_options& opt)
+{
+    std::vector<char> res(block.raw_size);
+    decode_payload(block, tables, payload, opt, res.data());
+    return res;
+}
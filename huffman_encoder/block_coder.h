@@ -0,0 +1,145 @@
+#ifndef BLOCK_CODER_H
+#define BLOCK_CODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "huffman_encoder.h"
+#include "block_format.h"
+#include "histogram.h"
+#include "tans_encoder.h"
+#include "context_model.h"
+#include "lz77.h"
+
+// Blocks of the container described in block_format.h, coded and decoded in memory
+
+constexpr unsigned DEFAULT_STREAM_BLOCK { 1024 * 1024 };
+
+enum coder_choice
+{
+    CODER_HUFFMAN,
+    CODER_TANS,
+    CODER_CONTEXT,      // Order-1 model, Huffman tables selected by the previous byte
+    CODER_SMALLEST      // Whichever coder gives the smaller block by the estimates
+};
+
+struct block_options
+{
+    bool use_automaton { false };
+    unsigned max_code_length { MAX_CODE_LENGTH };
+    unsigned checkpoint_interval { 0 };     // Zero writes no checkpoints
+    bool interleave { false };      // Blocks are split into STREAM_COUNT streams decoded together
+    coder_choice coder { CODER_HUFFMAN };   // Coder of blocks with their own tables
+    unsigned lz77_level { 0 };              // Zero codes bytes as they are, otherwise matches are found first
+    unsigned window { LZ77_DEFAULT_WINDOW };
+};
+
+struct encoded_block
+{
+    std::string header;
+    std::vector<char> payload;
+    unsigned long long raw_size;
+    std::vector<unsigned long long> checkpoints;
+    uint32_t checksum;      // Of the raw bytes
+};
+
+struct block_tables     // Tables built from one block, the block may still end up coded otherwise
+{
+    histogram counts;
+    std::shared_ptr<huffman_encoder> huffman;
+    std::shared_ptr<tans_encoder> tans;         // Null unless the tANS coder was chosen
+    std::shared_ptr<context_model> context;     // Null unless the order-1 coder was chosen
+    unsigned long long estimated_size;          // Table and payload of the chosen coder
+};
+
+enum block_choice
+{
+    CHOICE_NEW_TABLE,
+    CHOICE_REUSE,
+    CHOICE_STORED
+};
+
+struct block_info   // Header of a block as the decoder read it
+{
+    int type;           // Without flags
+    bool interleaved;
+    bool checksummed;
+    uint32_t checksum;
+    unsigned long long raw_size;
+    unsigned long long payload_size;
+};
+
+struct decoder_tables   // Tables of the last blocks which had them
+{
+    std::shared_ptr<huffman_encoder> huffman;   // Reused by BLOCK_REUSE
+    std::shared_ptr<tans_encoder> tans;
+    std::shared_ptr<context_model> context;
+};
+
+template <typename Table>
+std::string block_header(unsigned char type, unsigned long long raw_size, unsigned long long payload_size, uint32_t checksum,
+                         const Table* table)
+{
+    std::ostringstream header;
+    header.put(type | BLOCK_CHECKSUM);
+    write_varint(header, raw_size);
+    write_varint(header, payload_size);
+    write_checksum(header, checksum);
+    if (table != nullptr)
+        table->write_table(header);
+    return header.str();
+}
+
+template <typename Table>
+unsigned long long table_size(const Table& table)
+{
+    std::ostringstream header;
+    table.write_table(header);
+    return header.str().size();
+}
+
+bool valid_options(const block_options& opt);     // Same limits as the options of the tool
+
+std::vector<unsigned long long> stream_sizes(const huffman_encoder& encoder, const char* data, size_t n, bool counted,
+                                             const block_options& opt);
+std::string jump_table(const std::vector<unsigned long long>& sizes);
+unsigned long long coded_size(const std::vector<unsigned long long>& sizes);
+char* code_streams(const huffman_encoder& encoder, const char* data, size_t n, const std::vector<unsigned long long>& sizes, char* out);
+std::vector<unsigned long long> find_checkpoints(const huffman_encoder& encoder, const char* data, size_t n,
+                                                 const std::vector<unsigned long long>& sizes, const block_options& opt);
+size_t checkpoint_count(size_t n, const block_options& opt);
+
+block_tables build_tables(const char* data, size_t n, const block_options& opt);
+encoded_block encode_huffman(const char* data, size_t n, const huffman_encoder& table, bool counted, bool with_table,
+                             const block_options& opt);
+encoded_block encode_stored(const char* data, size_t n, const block_options& opt);
+encoded_block encode_with_tables(const char* data, size_t n, const block_tables& tables, const block_options& opt);
+encoded_block encode_lz77(const char* data, size_t n, const block_options& opt);
+encoded_block encode_block(const char* data, size_t n, const huffman_encoder* shared, bool with_table, const block_options& opt);
+encoded_block encode_block(const std::vector<char>& data, const huffman_encoder* shared, bool with_table, const block_options& opt);
+size_t stored_block_size(size_t n);     // Header included, blocks with their own tables are never larger
+// Codes a block with its own tables into `out`, returns its size or zero if it needs more than `capacity` bytes
+size_t encode_block_to(const char* data, size_t n, const block_options& opt, char* out, size_t capacity, block_record& record);
+block_choice choose_block(const block_tables& tables, const huffman_encoder* previous, size_t n);
+
+uint32_t chain_checksum(uint32_t crc, uint32_t block_checksum);
+std::string end_block(const std::vector<block_record>& blocks, unsigned long long checkpoint_interval);
+
+// Leaves the stream at the payload, tables of the block replace the ones before; false for corrupted headers,
+// raw sizes above BUFFER_SIZE included. The end block comes with its checksum, the index after it isn't read
+bool read_block_header(std::istream& is, block_info& block, decoder_tables& tables);
+
+// Decoders write `raw_size` bytes to `out`
+void decode_block(const huffman_encoder& table, const char* payload, size_t payload_size, unsigned long long raw_size,
+                  bool interleaved, const block_options& opt, char* out);
+void decode_tans_block(tans_encoder& decoder, const char* payload, size_t payload_size, unsigned long long raw_size, char* out);
+void decode_context_block(const context_model& model, const char* payload, size_t payload_size, unsigned long long raw_size, char* out);
+void decode_lz77_block(const char* payload, size_t payload_size, unsigned long long raw_size, char* out);
+void decode_payload(const block_info& block, const decoder_tables& tables, const char* payload, const block_options& opt, char* out);
+std::vector<char> decode_payload(const block_info& block, const decoder_tables& tables, const char* payload, const block_options& opt);
+
+#endif // BLOCK_CODER_H
@@ -0,0 +1,165 @@
+#ifndef BLOCK_FORMAT_H
+#define BLOCK_FORMAT_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "huffman_encoder.h"
+
+/*
+    Compressed file:  magic, blocks, end block, index, index offset
+    Block:            type, raw size, payload size, [checksum], [code length limit, code lengths], payload
+    Checksums:        with BLOCK_CHECKSUM in the type, the payload size is followed by the CRC-32C of the raw
+                      bytes of the block and the end block by the CRC-32C of the checksums of all blocks in order,
+                      each one a plain 4 byte number, least significant byte first
+    tANS block:       type, raw size, payload size, table log, normalized counts, payload; absent symbols
+                      are stored as a zero followed by the length of their run minus one
+    Stored block:     type, raw size, payload size equal to it, raw bytes
+    Order-1 block:    type, raw size, payload size, number of tables, table of every previous byte unless there
+                      is one table, tables as in Huffman blocks, payload; the first byte follows a zero byte
+    LZ77 block:       type, raw size, payload size, payload described in lz77.h
+    Interleaved:      payload starts with sizes of all streams but the last one, then the streams follow;
+                      stream `i` codes raw bytes from `i * stream_part(raw size)`
+    Index:            number of blocks, checkpoint interval, then packed size (header included), raw size
+                      and checkpoints of every block
+    Checkpoints:      bit offsets in the payload of every multiple of the interval inside the block, each one
+                      stored as the distance from the previous one; the decoder state is reset there, so decoding
+                      can start from any of them. Zero interval means there are no checkpoints. The state of
+                      tANS, order-1 and LZ77 blocks isn't reset and stored blocks need none, their checkpoints are
+                      zero placeholders
+    Sizes are stored as varints: 7 bits per byte, the highest bit marks continuation;
+    the index offset is a plain 8 byte number, least significant byte first, so the index can be found from the end of the file
+*/
+
+constexpr char FORMAT_MAGIC[] { 'H', 'U', 'F', '1' };
+constexpr unsigned MAGIC_SIZE { sizeof(FORMAT_MAGIC) };
+
+enum block_type : unsigned char
+{
+    BLOCK_END = 0,
+    BLOCK_HUFFMAN = 1,      // Block with its own table
+    BLOCK_REUSE = 2,        // Block coded with the table of the closest preceding BLOCK_HUFFMAN
+    BLOCK_TANS = 3,         // Block with its own tANS table, doesn't change the table reused by BLOCK_REUSE
+    BLOCK_STORED = 4,       // Raw bytes as the payload, for data the coders would only expand
+    BLOCK_CONTEXT = 5,      // Block with its own order-1 tables, doesn't change the table reused by BLOCK_REUSE
+    BLOCK_LZ77 = 6,         // Literals and matches with their own tables inside of the payload, see lz77.h
+    BLOCK_CHECKSUM = 0x40,      // Flag of any block, the header carries a checksum
+    BLOCK_INTERLEAVED = 0x80    // Flag of Huffman blocks, payload is split into STREAM_COUNT streams
+};
+
+constexpr unsigned CHECKSUM_SIZE { 4 };
+constexpr unsigned INDEX_OFFSET_SIZE { 8 };
+
+struct block_record
+{
+    unsigned long long packed_size;
+    unsigned long long raw_size;
+    std::vector<unsigned long long> checkpoints;    // Bit offset of raw offset `interval * (i + 1)`
+    uint32_t checksum;
+};
+
+inline void write_checksum(std::ostream& os, uint32_t checksum)
+{   // Least significant byte first
+    for (unsigned i = 0; i < CHECKSUM_SIZE; ++i)
+        os.put(static_cast<char>(checksum >> (i * 8)));
+}
+
+inline bool read_checksum(std::istream& is, uint32_t& checksum)
+{
+    unsigned char bytes[CHECKSUM_SIZE];
+    if (!is.read(reinterpret_cast<char*>(bytes), CHECKSUM_SIZE))
+        return false;
+    checksum = 0;
+    for (unsigned i = 0; i < CHECKSUM_SIZE; ++i)
+        checksum |= static_cast<uint32_t>(bytes[i]) << (i * 8);
+    return true;
+}
+
+inline void write_index_offset(std::ostream& os, unsigned long long offset)
+{   // Least significant byte first, whatever the byte order of the machine
+    for (unsigned i = 0; i < INDEX_OFFSET_SIZE; ++i)
+        os.put(static_cast<char>(offset >> (i * 8)));
+}
+
+inline unsigned long long read_index_offset(const char* p)     // Last INDEX_OFFSET_SIZE bytes of the file
+{
+    unsigned long long offset { };
+    for (unsigned i = 0; i < INDEX_OFFSET_SIZE; ++i)
+        offset |= static_cast<unsigned long long>(static_cast<unsigned char>(p[i])) << (i * 8);
+    return offset;
+}
+
+inline void write_varint(std::ostream& os, unsigned long long value)
+{
+    do
+    {
+        char byte = value & 0x7f;
+        value >>= 7;
+        if (value > 0)
+            byte |= 0x80;
+        os.put(byte);
+    } while (value > 0);
+}
+
+inline unsigned varint_size(unsigned long long value)
+{
+    unsigned res { 1 };
+    for (; value >= 0x80; value >>= 7)
+        ++res;
+    return res;
+}
+
+inline bool read_varint(std::istream& is, unsigned long long& value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        int byte = is.get();
+        if (byte == std::istream::traits_type::eof())
+            return false;
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+inline const char* read_varint(const char* p, const char* end, unsigned long long& value)
+{   // Returns the position after the number or null
+    value = 0;
+    for (unsigned shift = 0; shift < 64 && p < end; shift += 7)
+    {
+        const unsigned char byte = *p++;
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return p;
+    }
+    return nullptr;
+}
+
+inline bool split_streams(const char* payload, size_t size, const char* streams[STREAM_COUNT], size_t sizes[STREAM_COUNT])
+{
+    const char* end { payload + size };
+    const char* p { payload };
+    for (unsigned i = 0; i + 1 < STREAM_COUNT; ++i)
+    {
+        unsigned long long n;
+        p = read_varint(p, end, n);
+        if (p == nullptr || n > size)
+            return false;
+        sizes[i] = n;
+    }
+    for (unsigned i = 0; i < STREAM_COUNT; ++i)
+    {
+        if (i + 1 == STREAM_COUNT)
+            sizes[i] = end - p;
+        if (sizes[i] > static_cast<size_t>(end - p))
+            return false;
+        streams[i] = p;
+        p += sizes[i];
+    }
+    return true;
+}
+
+#endif // BLOCK_FORMAT_H
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include "context_model.h"
+#include "histogram.h"
+#include "bit_writer.h"
+#include "bit_reader.h"
+
+namespace
+{
+    constexpr unsigned CLUSTER_ROUNDS { 4 };    // Rounds of k-means for every number of tables
+    constexpr double SMOOTHING { 0.1 };         // Added to counts of a cluster, so contexts with unseen symbols still have a cost
+
+    void assign_contexts(const std::vector<histogram>& contexts, const std::vector<unsigned>& present,
+                         const std::vector<histogram>& clusters, unsigned char* assignment)
+    {   // Every context goes to the cluster which would code it in the fewest bits
+        std::vector<double> cost(clusters.size() * CHAR_RANGE);
+        for (size_t k = 0; k < clusters.size(); ++k)
+        {
+            for (unsigned s = 0; s < CHAR_RANGE; ++s)
+                cost[k * CHAR_RANGE + s] = -std::log2((clusters[k].counts[s] + SMOOTHING) / (clusters[k].total + SMOOTHING * CHAR_RANGE));
+        }
+        for (unsigned c : present)
+        {
+            double best { };
+            for (size_t k = 0; k < clusters.size(); ++k)
+            {
+                double bits { };
+                for (unsigned s = 0; s < CHAR_RANGE; ++s)
+                    bits += contexts[c].counts[s] * cost[k * CHAR_RANGE + s];
+                if (k == 0 || bits < best)
+                {
+                    best = bits;
+                    assignment[c] = static_cast<unsigned char>(k);
+                }
+            }
+        }
+    }
+}
+
+void context_model::build(const char* data, size_t n, unsigned max_code_length)
+{   // Contexts are clustered by k-means for 1, 2, 4... tables, the number with the smallest estimate wins
+    std::vector<histogram> contexts(CHAR_RANGE);
+    std::vector<unsigned> present;      // Contexts by decreasing counts, the largest ones seed the clusters
+    unsigned char previous { };
+
+    max_code_length = std::min(max_code_length, CONTEXT_CODE_LENGTH);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const unsigned char c = data[i];
+        ++contexts[previous].counts[c];
+        ++contexts[previous].total;
+        previous = c;
+    }
+    for (unsigned c = 0; c < CHAR_RANGE; ++c)
+    {
+        if (contexts[c].total > 0)
+            present.push_back(c);
+    }
+    std::stable_sort(present.begin(), present.end(), [&](unsigned a, unsigned b) { return contexts[a].total > contexts[b].total; });
+
+    unsigned char best[CHAR_RANGE] { };
+    ull best_size { ULLONG_MAX };
+    for (unsigned k = 1; k <= MAX_CONTEXT_TABLES && k <= present.size(); k *= 2)
+    {
+        unsigned char assignment[CHAR_RANGE] { };
+        std::vector<histogram> clusters(k);
+        for (unsigned i = 0; i < k; ++i)
+            clusters[i] = contexts[present[i]];
+        for (unsigned round = 0; round < CLUSTER_ROUNDS; ++round)
+        {
+            assign_contexts(contexts, present, clusters, assignment);
+            for (auto& h : clusters) { h.clear(); }
+            for (unsigned c : present) { clusters[assignment[c]].merge(contexts[c]); }
+        }
+        const ull size { assign_tables(contexts, assignment, max_code_length) };
+        if (size < best_size)
+        {
+            best_size = size;
+            std::copy(assignment, assignment + CHAR_RANGE, best);
+        }
+    }
+    assign_tables(contexts, best, max_code_length);
+    build_codes();
+}
+
+context_model::ull context_model::assign_tables(const std::vector<histogram>& contexts, const unsigned char* assignment,
+                                                unsigned max_code_length)
+{   // Returns the estimated size of the tables and the payload, empty clusters are dropped
+    std::vector<histogram> clusters(MAX_CONTEXT_TABLES);
+    unsigned char number[MAX_CONTEXT_TABLES] { };
+
+    for (unsigned c = 0; c < CHAR_RANGE; ++c)
+        clusters[assignment[c]].merge(contexts[c]);
+    tables.clear();
+    coded_bits = 0;
+    for (unsigned k = 0; k < MAX_CONTEXT_TABLES; ++k)
+    {
+        if (clusters[k].total == 0)
+            continue;
+        auto table = std::make_shared<huffman_encoder>();
+        table->set_code_length_limit(max_code_length);
+        table->init_for_compressing();
+        table->add_counts(clusters[k]);
+        table->encode();
+        for (unsigned s = 0; s < CHAR_RANGE; ++s)
+        {
+            lengths[tables.size()][s] = static_cast<unsigned char>(table->code_length_of(static_cast<char>(s)));
+            coded_bits += clusters[k].counts[s] * lengths[tables.size()][s];
+        }
+        number[k] = static_cast<unsigned char>(tables.size());
+        tables.push_back(table);
+    }
+    for (unsigned c = 0; c < CHAR_RANGE; ++c)
+        cluster[c] = number[assignment[c]];
+
+    std::ostringstream header;
+    write_table(header);
+    return header.str().size() + estimated_size();
+}
+
+bool context_model::build_codes()
+{   // Canonical codes, shorter ones first and symbols of equal lengths in order
+    lookup.assign(tables.size() << LOOKUP_BITS, lookup_entry { 0, 0 });
+    for (size_t t = 0; t < tables.size(); ++t)
+    {
+        uint32_t next { };
+        for (unsigned length = 1; length <= CONTEXT_CODE_LENGTH; ++length, next <<= 1)
+        {
+            for (unsigned s = 0; s < CHAR_RANGE; ++s)
+            {
+                if (lengths[t][s] != length)
+                    continue;
+                if (next >= (1u << length))
+                    return false;
+                const unsigned shift { LOOKUP_BITS - length };
+                const auto first = lookup.begin() + (t << LOOKUP_BITS);
+                std::fill(first + (next << shift), first + ((next + 1) << shift),
+                          lookup_entry { static_cast<unsigned char>(s), static_cast<unsigned char>(length) });
+                codes[t][s] = next++;
+            }
+        }
+    }
+    for (unsigned c = 0; c < CHAR_RANGE; ++c)
+        offsets[c] = static_cast<uint32_t>(cluster[c]) << LOOKUP_BITS;
+    return true;
+}
+
+bool context_model::read_table(std::istream& is)
+{
+    const int count { is.get() };
+    if (count < 1 || count > static_cast<int>(MAX_CONTEXT_TABLES))
+        return false;
+    std::fill(cluster, cluster + CHAR_RANGE, 0);
+    if (count > 1 && !is.read(reinterpret_cast<char*>(cluster), CHAR_RANGE))
+        return false;
+    tables.clear();
+    coded_bits = 0;
+    for (int t = 0; t < count; ++t)
+    {
+        auto table = std::make_shared<huffman_encoder>();
+        if (!table->read_table(is))
+            return false;
+        for (unsigned s = 0; s < CHAR_RANGE; ++s)
+        {
+            lengths[t][s] = static_cast<unsigned char>(table->code_length_of(static_cast<char>(s)));
+            if (lengths[t][s] > CONTEXT_CODE_LENGTH)
+                return false;
+        }
+        tables.push_back(table);
+    }
+    for (unsigned c = 0; c < CHAR_RANGE; ++c)
+    {
+        if (cluster[c] >= count)
+            return false;
+    }
+    return build_codes();
+}
+
+void context_model::write_table(std::ostream& os) const
+{   // Number of tables, the table of every previous byte unless there is one, then the tables
+    os.put(static_cast<char>(tables.size()));
+    if (tables.size() > 1)
+        os.write(reinterpret_cast<const char*>(cluster), CHAR_RANGE);
+    for (auto& table : tables)
+        table->write_table(os);
+}
+
+context_model::ull context_model::estimated_size() const
+{
+    return (coded_bits + CHAR_DIGITS - 1) / CHAR_DIGITS;
+}
+
+size_t context_model::max_payload_size(size_t n)
+{   // With a word to spare, the writer flushes the last codes by whole words as well
+    return (static_cast<unsigned long long>(n) * CONTEXT_CODE_LENGTH + CHAR_DIGITS - 1) / CHAR_DIGITS + BIT_WRITER_SLACK;
+}
+
+size_t context_model::encode_block(const uint8_t* in, size_t n, char* out) const
+{
+    bit_writer writer { out, max_payload_size(n) };
+    unsigned char previous { };
+    for (size_t i = 0; i < n; ++i)
+    {
+        const unsigned t { cluster[previous] };
+        writer.put(codes[t][in[i]], lengths[t][in[i]]);
+        previous = in[i];
+    }
+    return writer.finish();
+}
+
+bool context_model::decompress_block(const char* data, size_t n, char* out, size_t size) const
+{   // Table is picked by adding an offset to the lookup, so switching tables costs no branches
+    bit_reader reader { data, n };
+    const lookup_entry* table { lookup.data() };
+    uint32_t offset { offsets[0] };
+    unsigned invalid { };
+    for (size_t i = 0; i < size; ++i)
+    {
+        const lookup_entry e { table[offset + (reader.peek() >> (64 - LOOKUP_BITS))] };
+        out[i] = static_cast<char>(e.symbol);
+        reader.position += e.length;
+        invalid |= e.length == 0;
+        offset = offsets[e.symbol];
+    }
+    return invalid == 0 && (reader.position + CHAR_DIGITS - 1) / CHAR_DIGITS == n;
+}
@@ -0,0 +1,48 @@
+#ifndef CONTEXT_MODEL_H
+#define CONTEXT_MODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "huffman_encoder.h"
+
+constexpr unsigned MAX_CONTEXT_TABLES { 16 };             // Previous bytes are clustered into at most this many tables
+constexpr unsigned CONTEXT_CODE_LENGTH { LOOKUP_BITS };   // Every code fits the lookup table, so a symbol takes one lookup
+
+struct histogram;
+
+struct context_model    // Order-1 model, the previous byte selects the Huffman table of the next one
+{
+    typedef unsigned long long ull;
+
+    void build(const char* data, size_t n, unsigned max_code_length);     // Data mustn't be empty
+    bool read_table(std::istream& is);
+    void write_table(std::ostream& os) const;
+    ull estimated_size() const;     // Payload of the data the model was built from, in bytes
+    static size_t max_payload_size(size_t n);
+    size_t encode_block(const uint8_t* in, size_t n, char* out) const;     // `out` must fit max_payload_size(n) bytes
+    bool decompress_block(const char* data, size_t n, char* out, size_t size) const;    // False for corrupted data
+
+private:
+    struct lookup_entry
+    {
+        unsigned char symbol;
+        unsigned char length;   // Zero if no code starts with these bits
+    };
+
+    ull assign_tables(const std::vector<histogram>& contexts, const unsigned char* assignment, unsigned max_code_length);
+    bool build_codes();
+
+    std::vector<std::shared_ptr<huffman_encoder>> tables { };
+    unsigned char cluster[CHAR_RANGE] { };      // Table of every previous byte, the first byte of a block follows zero
+    unsigned char lengths[MAX_CONTEXT_TABLES][CHAR_RANGE] { };
+    uint32_t codes[MAX_CONTEXT_TABLES][CHAR_RANGE] { };
+    uint32_t offsets[CHAR_RANGE] { };           // Position of the lookup table of every previous byte
+    std::vector<lookup_entry> lookup { };       // 2^LOOKUP_BITS entries per table
+    ull coded_bits { };
+};
+
+#endif // CONTEXT_MODEL_H
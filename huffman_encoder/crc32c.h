@@ -0,0 +1,11 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli), the one computed by the crc32 instruction of SSE4.2
+// Checksum of concatenated data is computed by passing the checksum of the first part as `crc`
+uint32_t crc32c(const char* data, size_t n, uint32_t crc = 0);
+
+#endif // CRC32C_H
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <future>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "dictionary.h"
+#include "block_format.h"
+#include "bit_writer.h"
+#include "crc32c.h"
+
+namespace
+{
+    bool codes_every_byte(const huffman_encoder& table)
+    {
+        for (int c = CHAR_MIN; c <= CHAR_MAX; ++c)
+        {
+            if (table.code_length_of(static_cast<char>(c)) == 0)
+                return false;
+        }
+        return true;
+    }
+
+    unsigned shortest_code(const huffman_encoder& table)
+    {
+        unsigned res { MAX_CODE_LENGTH };
+        for (int c = CHAR_MIN; c <= CHAR_MAX; ++c)
+            res = std::min(res, table.code_length_of(static_cast<char>(c)));
+        return res;
+    }
+
+    unsigned longest_code(const huffman_encoder& table)
+    {
+        unsigned res { };
+        for (int c = CHAR_MIN; c <= CHAR_MAX; ++c)
+            res = std::max(res, table.code_length_of(static_cast<char>(c)));
+        return res;
+    }
+
+    void compress_into(const huffman_dictionary& dict, const char* data, size_t n, std::vector<char>& out)
+    {   // Spare word lets the writer store whole words up to the last code
+        const unsigned long long bits { dict.table.payload_bits(data, n) };
+        const unsigned padding { static_cast<unsigned>((CHAR_DIGITS - bits % CHAR_DIGITS) % CHAR_DIGITS) };
+        out.resize((bits + padding) / CHAR_DIGITS + BIT_WRITER_SLACK);
+        bit_writer writer { out.data(), out.size() };
+        dict.table.encode_block(reinterpret_cast<const uint8_t*>(data), n, writer);
+        writer.put((1u << padding) - 1, padding);
+        out.resize(writer.finish());
+    }
+
+    struct message_decoder      // Tables of the dictionary with the lookup of the decoder built once
+    {
+        explicit message_decoder(const huffman_dictionary& dict)
+        : min_length { shortest_code(dict.table) }
+        {
+            decoder.copy_table(dict.table);
+            decoder.build_lookup();
+        }
+
+        std::vector<char> decode(const char* payload, size_t n)
+        {   // No message decodes to more symbols than its bits hold of the shortest code
+            const size_t capacity { n * CHAR_DIGITS / min_length };
+            scratch.resize(capacity);
+            decoder.init_for_decompressing(capacity);
+            const huffman_encoder::decode_result done { decoder.decompress_block(payload, n, scratch.data(), capacity) };
+            if (done.consumed != n || decoder.pending_bits() >= CHAR_DIGITS)
+                throw std::runtime_error { "Message is corrupted" };
+            return std::vector<char>(scratch.begin(), scratch.begin() + done.produced);
+        }
+
+    private:
+        huffman_encoder decoder { };
+        unsigned min_length;
+        std::vector<char> scratch { };
+    };
+
+    template <typename Range>
+    void run_batch(size_t count, thread_pool* pool, Range range)
+    {   // Messages are split into one range per thread
+        if (pool == nullptr || pool->size() < 2 || count < 2)
+        {
+            range(0, count);
+            return;
+        }
+        const size_t part { (count + pool->size() - 1) / pool->size() };
+        std::vector<std::future<void>> parts;
+        for (size_t begin = 0; begin < count; begin += part)
+            parts.push_back(pool->submit([range, begin, part, count] { range(begin, std::min(count, begin + part)); }));
+        for (auto& p : parts)
+            p.get();
+    }
+}
+
+std::shared_ptr<huffman_dictionary> train_dictionary(const histogram& counts, uint32_t id, unsigned max_code_length,
+                                                     unsigned long long smoothing)
+{
+    auto res = std::make_shared<huffman_dictionary>();
+    histogram smoothed { counts };
+    smoothing = std::max(smoothing, 1ull);
+    for (unsigned c = 0; c < CHAR_RANGE; ++c)
+        smoothed.counts[c] += smoothing;
+    smoothed.total += smoothing * CHAR_RANGE;
+
+    res->id = id;
+    res->table.set_code_length_limit(max_code_length);
+    res->table.init_for_compressing();
+    res->table.add_counts(smoothed);
+    res->table.encode();
+    return res;
+}
+
+void write_dictionary(std::ostream& os, const huffman_dictionary& dict)
+{
+    std::ostringstream body;
+    body.write(DICTIONARY_MAGIC, sizeof(DICTIONARY_MAGIC));
+    write_varint(body, dict.id);
+    dict.table.write_table(body);
+    const std::string bytes { body.str() };
+    os.write(bytes.data(), bytes.size());
+    write_checksum(os, crc32c(bytes.data(), bytes.size()));
+}
+
+std::shared_ptr<huffman_dictionary> read_dictionary(std::istream& is)
+{
+    const std::string bytes { std::istreambuf_iterator<char> { is }, std::istreambuf_iterator<char> { } };
+    if (bytes.size() < sizeof(DICTIONARY_MAGIC) + CHECKSUM_SIZE
+        || !std::equal(DICTIONARY_MAGIC, DICTIONARY_MAGIC + sizeof(DICTIONARY_MAGIC), bytes.data()))
+        return nullptr;
+
+    std::istringstream body { bytes.substr(sizeof(DICTIONARY_MAGIC), bytes.size() - sizeof(DICTIONARY_MAGIC) - CHECKSUM_SIZE) };
+    std::istringstream tail { bytes.substr(bytes.size() - CHECKSUM_SIZE) };
+    auto res = std::make_shared<huffman_dictionary>();
+    unsigned long long id;
+    uint32_t checksum;
+    if (!read_checksum(tail, checksum) || checksum != crc32c(bytes.data(), bytes.size() - CHECKSUM_SIZE)
+        || !read_varint(body, id) || id > UINT32_MAX || !res->table.read_table(body) || body.peek() != std::istream::traits_type::eof()
+        || !codes_every_byte(res->table))
+        return nullptr;
+    res->id = static_cast<uint32_t>(id);
+    res->table.assign_codes();
+    return res;
+}
+
+size_t message_bound(const huffman_dictionary& dict, size_t n)
+{
+    return (static_cast<unsigned long long>(n) * longest_code(dict.table) + CHAR_DIGITS - 1) / CHAR_DIGITS;
+}
+
+std::vector<char> dictionary_compress(const huffman_dictionary& dict, const char* data, size_t n)
+{
+    std::vector<char> res;
+    compress_into(dict, data, n, res);
+    return res;
+}
+
+std::vector<char> dictionary_decompress(const huffman_dictionary& dict, const char* payload, size_t n)
+{   // Builds the decoder tables for one message, batches build them once
+    return message_decoder { dict }.decode(payload, n);
+}
+
+std::vector<std::vector<char>> compress_batch(const huffman_dictionary& dict, const std::vector<std::vector<char>>& messages,
+                                              thread_pool* pool)
+{
+    std::vector<std::vector<char>> res(messages.size());
+    run_batch(messages.size(), pool, [&dict, &messages, &res](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            compress_into(dict, messages[i].data(), messages[i].size(), res[i]);
+    });
+    return res;
+}
+
+std::vector<std::vector<char>> decompress_batch(const huffman_dictionary& dict, const std::vector<std::vector<char>>& payloads,
+                                                thread_pool* pool)
+{
+    std::vector<std::vector<char>> res(payloads.size());
+    run_batch(payloads.size(), pool, [&dict, &payloads, &res](size_t begin, size_t end)
+    {
+        message_decoder decoder { dict };
+        for (size_t i = begin; i < end; ++i)
+            res[i] = decoder.decode(payloads[i].data(), payloads[i].size());
+    });
+    return res;
+}
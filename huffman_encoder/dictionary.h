@@ -0,0 +1,50 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "huffman_encoder.h"
+#include "histogram.h"
+#include "thread_pool.h"
+
+/*
+    Small messages coded against a table trained beforehand, so they carry no header at all:
+
+    Dictionary file:  magic, varint ID, table as in Huffman blocks, CRC-32C of the bytes before it
+    Message:          codes of its bytes, the last byte padded with ones. Every byte value has a code, so the
+                      longest code has at least 8 bits and the last code of canonical order is all ones: padding
+                      is never a whole code and the message ends with its payload, its size isn't stored
+
+    The ID is for the application to tell which dictionary its messages were coded with, messages don't carry it
+*/
+
+constexpr char DICTIONARY_MAGIC[] { 'H', 'U', 'F', 'D' };
+constexpr unsigned long long DEFAULT_SMOOTHING { 1 };      // Added to the count of every byte value
+
+struct huffman_dictionary
+{
+    uint32_t id;
+    huffman_encoder table;      // Codes every byte value
+};
+
+// Smoothing of zero is taken as one, as absent byte values couldn't be coded
+std::shared_ptr<huffman_dictionary> train_dictionary(const histogram& counts, uint32_t id, unsigned max_code_length = MAX_CODE_LENGTH,
+                                                     unsigned long long smoothing = DEFAULT_SMOOTHING);
+void write_dictionary(std::ostream& os, const huffman_dictionary& dict);
+std::shared_ptr<huffman_dictionary> read_dictionary(std::istream& is);     // Reads the rest of the stream, null if it is corrupted
+
+size_t message_bound(const huffman_dictionary& dict, size_t n);         // Largest payload of a message of `n` bytes
+std::vector<char> dictionary_compress(const huffman_dictionary& dict, const char* data, size_t n);
+std::vector<char> dictionary_decompress(const huffman_dictionary& dict, const char* payload, size_t n);    // Throws for corrupted payloads
+
+// Decoder tables are built once for all messages, or once per thread of the pool
+std::vector<std::vector<char>> compress_batch(const huffman_dictionary& dict, const std::vector<std::vector<char>>& messages,
+                                              thread_pool* pool = nullptr);
+std::vector<std::vector<char>> decompress_batch(const huffman_dictionary& dict, const std::vector<std::vector<char>>& payloads,
+                                                thread_pool* pool = nullptr);
+
+#endif // DICTIONARY_H
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <vector>
+#include "histogram.h"
+
+namespace
+{
+    constexpr size_t MAX_CHUNK { size_t { 1 } << 30 };          // 32-bit counters can't overflow within a chunk
+    constexpr size_t MIN_PARALLEL_PART { 256 * 1024 };          // Smaller parts aren't worth a task
+
+    void reduce(const uint32_t (&tables)[HISTOGRAM_TABLES][CHAR_RANGE], unsigned long long* counts)
+    {   // Once per chunk, the counting loop is what takes the time
+        for (unsigned c = 0; c < CHAR_RANGE; ++c)
+        {
+            for (unsigned t = 0; t < HISTOGRAM_TABLES; ++t)
+                counts[c] += tables[t][c];
+        }
+    }
+}
+
+void histogram::clear()
+{
+    std::fill(counts, counts + CHAR_RANGE, 0);
+    total = 0;
+}
+
+void histogram::add(const char* data, size_t n)
+{
+    const unsigned char* p { reinterpret_cast<const unsigned char*>(data) };
+
+    total += n;
+    while (n > 0)
+    {
+        const size_t len { std::min(n, MAX_CHUNK) };
+        uint32_t tables[HISTOGRAM_TABLES][CHAR_RANGE] { };
+        size_t i { };
+
+        for (; i + 8 <= len; i += 8)
+        {
+            uint64_t v;
+            memcpy(&v, p + i, sizeof(v));
+            ++tables[0][v & 0xff];
+            ++tables[1][(v >> 8) & 0xff];
+            ++tables[2][(v >> 16) & 0xff];
+            ++tables[3][(v >> 24) & 0xff];
+            ++tables[4][(v >> 32) & 0xff];
+            ++tables[5][(v >> 40) & 0xff];
+            ++tables[6][(v >> 48) & 0xff];
+            ++tables[7][v >> 56];
+        }
+        for (; i < len; ++i)
+            ++tables[0][p[i]];
+        reduce(tables, counts);
+        p += len;
+        n -= len;
+    }
+}
+
+void histogram::add_parallel(const char* data, size_t n, thread_pool& pool)
+{
+    const size_t parts { std::min<size_t>(pool.size(), n / MIN_PARALLEL_PART) };
+    if (parts <= 1)
+    {
+        add(data, n);
+        return;
+    }
+
+    std::vector<std::future<histogram>> pending;
+    for (size_t i = 0; i < parts; ++i)
+    {
+        const size_t begin { n / parts * i };
+        const size_t end { i + 1 == parts ? n : n / parts * (i + 1) };
+        pending.push_back(pool.submit([data, begin, end]
+        {
+            histogram h { };
+            h.add(data + begin, end - begin);
+            return h;
+        }));
+    }
+    for (auto& f : pending) { merge(f.get()); }
+}
+
+void histogram::merge(const histogram& other)
+{
+    for (unsigned c = 0; c < CHAR_RANGE; ++c)
+        counts[c] += other.counts[c];
+    total += other.total;
+}
@@ -0,0 +1,23 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstddef>
+#include "huffman_encoder.h"
+#include "thread_pool.h"
+
+constexpr unsigned HISTOGRAM_TABLES { 8 };     // Table per byte of a 64-bit word, so repeated bytes don't wait for each other's stores
+
+struct histogram
+{
+    typedef unsigned long long ull;
+
+    ull counts[CHAR_RANGE] { };     // Indexed by unsigned char
+    ull total { };
+
+    void clear();
+    void add(const char* data, size_t n);
+    void add_parallel(const char* data, size_t n, thread_pool& pool);    // Splits data between threads, mustn't be called from a task of the same pool
+    void merge(const histogram& other);
+};
+
+#endif // HISTOGRAM_H
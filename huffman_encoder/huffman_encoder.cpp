@@ -1,110 +1,544 @@
 #include <vector>
-#include <queue>
 #include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
 #include "huffman_encoder.h"
+#include "histogram.h"
+#include "bit_writer.h"
+#include "bit_reader.h"
+
+void huffman_code_lengths(const unsigned long long counts[CHAR_RANGE], unsigned char lengths[CHAR_RANGE])
+{   // Leaves sorted by count, then parents in the order they are made: their weights never decrease, so the two
+    // smallest nodes are always at the fronts of these two queues. Depths replace parents from the root down
+    unsigned long long weight[2 * CHAR_RANGE];
+    unsigned short node[2 * CHAR_RANGE];    // Symbol of a leaf, then parent of every node, then its depth
+    unsigned n { };
+
+    for (unsigned s = 0; s < CHAR_RANGE; ++s)
+    {
+        lengths[s] = 0;
+        if (counts[s] > 0)
+            node[n++] = static_cast<unsigned short>(s);
+    }
+    if (n == 0)
+        return;
+    if (n == 1)
+    {
+        lengths[node[0]] = 1;
+        return;
+    }
+    std::sort(node, node + n, [counts](unsigned short a, unsigned short b)
+    {   // Ties go to the smaller symbol, so lengths don't depend on the sort
+        return counts[a] != counts[b] ? counts[a] < counts[b] : a < b;
+    });
+    unsigned short symbol[CHAR_RANGE];
+    std::copy(node, node + n, symbol);
+    for (unsigned i = 0; i < n; ++i)
+        weight[i] = counts[symbol[i]];
+
+    unsigned leaf { }, parent { n }, next { n };
+    auto smallest = [&]
+    {   // Leaves win ties, which keeps the longest code shorter
+        return leaf < n && (parent == next || weight[leaf] <= weight[parent]) ? leaf++ : parent++;
+    };
+    for (; next < 2 * n - 1; ++next)
+    {
+        const unsigned a { smallest() };
+        const unsigned b { smallest() };
+        weight[next] = weight[a] + weight[b];
+        node[a] = node[b] = static_cast<unsigned short>(next);
+    }
+    node[2 * n - 2] = 0;
+    for (unsigned i = 2 * n - 2; i-- > 0;)
+        node[i] = node[node[i]] + 1;
+    for (unsigned i = 0; i < n; ++i)
+        lengths[symbol[i]] = static_cast<unsigned char>(node[i]);
+}
 
 void huffman_encoder::init_for_compressing()
-{
+{   // Codes of the previous table go too, a symbol absent from the new one mustn't keep its old code
     std::fill(char_count_, char_count_ + CHAR_RANGE, 0);
+    std::fill(flat_codes, flat_codes + CHAR_RANGE, flat_code { });
     file_size = 0;
 }
 
-void huffman_encoder::init_for_decompressing()
+void huffman_encoder::init_for_decompressing(ull size)
 {
-    ca.cur = 0;
+    file_size = size;
     written_bytes = 0;
+    bits = 0;
+    bit_count = 0;
+    state = { 0, 0 };
 }
 
-void huffman_encoder::traverse(ptr cur)
+void huffman_encoder::sort_symbols()
 {
-    if (!cur->left && !cur->right)
+    std::fill(length_count, length_count + CHAR_RANGE, 0);
+    max_length = 0;
+    for (int c = CHAR_MIN; c <= CHAR_MAX; ++c)
+    {
+        ++length_count[code_length[c]];
+        max_length = std::max<unsigned>(max_length, code_length[c]);
+    }
+    length_count[0] = 0;
+    for (unsigned len = 1, offset = 0; len <= max_length; ++len)
+    {
+        length_offset[len] = offset;
+        offset += length_count[len];
+    }
+
+    unsigned position[CHAR_RANGE];
+    std::copy(length_offset, length_offset + CHAR_RANGE, position);
+    for (int c = CHAR_MIN; c <= CHAR_MAX; ++c)
+    {
+        if (code_length[c] > 0)
+            sorted[position[code_length[c]]++] = static_cast<char>(c);
+    }
+}
+
+bool huffman_encoder::step(canonical_state& s, unsigned bit, char& c) const
+{   // Symbol is decoded if it returns true; if it returns false and depth reached `max_length`, code is invalid
+    s.code += bit;
+    const unsigned count { length_count[++s.depth] };
+    if (s.code < count)
     {
-        if (seq.size == 0) seq.append(0);
-        code_table[static_cast<int>(cur->c)] = seq;
+        c = sorted[length_offset[s.depth] + s.code];
+        s = { 0, 0 };
+        return true;
     }
-    else
+    s.code = (s.code - count) << 1;
+    return false;
+}
+
+void huffman_encoder::build_lookup()
+{   // Tables are kept until the code changes
+    if (lookup)
+        return;
+    std::vector<lookup_entry> table;
+    build_table(table, { 0, 0 }, LOOKUP_BITS);
+    lookup = std::make_shared<std::vector<lookup_entry>>(std::move(table));
+}
+
+size_t huffman_encoder::build_table(std::vector<lookup_entry>& table, canonical_state s, unsigned width) const
+{
+    const size_t offset { table.size() };
+
+    table.resize(offset + (size_t { 1 } << width));
+
+    for (size_t index = 0; index < (size_t { 1 } << width); ++index)
+    {
+        lookup_entry e { };
+        canonical_state cur { s };
+        unsigned used { };
+        bool invalid { false };
+
+        for (unsigned i = 0; i < width; ++i)
+        {
+            char c;
+            if (step(cur, (index >> (width - 1 - i)) & 1, c))
+            {
+                e.symbols[e.count++] = c;
+                used = i + 1;
+                if (e.count == MAX_LOOKUP_SYMBOLS)
+                    break;
+            }
+            else if (cur.depth >= max_length)
+            {
+                invalid = true;
+                break;
+            }
+        }
+        if (e.count > 0)
+        {
+            e.length = used;
+        }
+        else if (!invalid)  // Code is longer than the table
+        {
+            e.length = width;
+            e.width = std::min(SUBTABLE_BITS, max_length - cur.depth);
+            e.link = build_table(table, cur, e.width);
+        }
+        table[offset + index] = e;
+    }
+    return offset;
+}
+
+std::vector<char> huffman_encoder::decompress_iteration(char c)
+{
+    std::vector<char> res;
+    for (int k = CHAR_DIGITS - 1; k >= 0; --k)
+    {
+        const unsigned bit { ((1 << k) & c) > 0 };
+        char symbol;
+        if (step(state, bit, symbol))
+        {
+            if (written_bytes == file_size)     // Padding of the last byte may look like more symbols
+                return res;
+            res.push_back(symbol);
+            ++written_bytes;
+        }
+        else if (state.depth >= max_length)
+        {
+            throw std::runtime_error { "Invalid code" };
+        }
+    }
+    return res;
+}
+
+huffman_encoder::decode_result huffman_encoder::decompress_block(const char* data, size_t n, char* out, size_t capacity)
+{   // Stops when the block is finished, the output is full or the input is exhausted
+    const lookup_entry* const table { lookup->data() };
+    size_t pos { };
+    size_t produced { };
+
+    while (written_bytes < file_size && produced < capacity)
+    {
+        while (state.depth == 0 && n - pos >= sizeof(ull) && capacity - produced >= MAX_LOOKUP_SYMBOLS
+               && file_size - written_bytes >= MAX_LOOKUP_SYMBOLS)
+        {   // Input is refilled a word at a time and holds more bits than any chain of tables reads.
+            // Bits past the counted bytes are those the next word brings to the same place
+            if (bit_count <= 56)
+            {
+                bits |= load_big_endian(data + pos) >> bit_count;
+                const unsigned bytes { (64 - bit_count) / CHAR_DIGITS };
+                pos += bytes;
+                bit_count += bytes * CHAR_DIGITS;
+            }
+            const lookup_entry* e { &table[bits >> (64 - LOOKUP_BITS)] };
+            unsigned used { };
+            while (e->count == 0 && e->width != 0)
+            {
+                used += e->length;
+                e = &table[e->link + ((bits << used) >> (64 - e->width))];
+            }
+            if (e->count == 0)
+                throw std::runtime_error { "Invalid code" };
+            used += e->length;
+            bits <<= used;
+            bit_count -= used;
+            memcpy(out + produced, e->symbols, MAX_LOOKUP_SYMBOLS);
+            produced += e->count;
+            written_bytes += e->count;
+        }
+        if (written_bytes == file_size || produced == capacity)
+            break;
+        while (bit_count <= 56 && pos < n)
+        {
+            bits |= static_cast<ull>(static_cast<unsigned char>(data[pos++])) << (56 - bit_count);
+            bit_count += CHAR_DIGITS;
+        }
+        if (state.depth == 0 && bit_count >= LOOKUP_BITS && capacity - produced >= MAX_LOOKUP_SYMBOLS)
+        {
+            const lookup_entry* e { &table[bits >> (64 - LOOKUP_BITS)] };
+            unsigned used { };
+
+            while (e->count == 0 && e->width != 0 && bit_count >= used + e->length + e->width)
+            {
+                used += e->length;
+                e = &table[e->link + ((bits << used) >> (64 - e->width))];
+            }
+            if (e->count == 0 && e->width == 0)
+                throw std::runtime_error { "Invalid code" };
+            if (e->count > 0)
+            {
+                used += e->length;
+                bits <<= used;
+                bit_count -= used;
+                memcpy(out + produced, e->symbols, MAX_LOOKUP_SYMBOLS);     // Extra symbols are overwritten later
+                const unsigned k { static_cast<unsigned>(std::min<ull>(e->count, file_size - written_bytes)) };
+                produced += k;
+                written_bytes += k;
+                continue;
+            }
+        }
+        if (bit_count == 0)
+            break;
+        // Near the end of the input or the output only bit-at-a-time decoding is possible
+        char c;
+        const unsigned bit { static_cast<unsigned>(bits >> 63) };
+        bits <<= 1;
+        --bit_count;
+        if (step(state, bit, c))
+        {
+            out[produced++] = c;
+            ++written_bytes;
+        }
+        else if (state.depth >= max_length)
+        {
+            throw std::runtime_error { "Invalid code" };
+        }
+    }
+    return { pos, produced };
+}
+
+unsigned huffman_encoder::decode_entry(const char* data, ull& position, char* out) const
+{   // Reads 8 bytes from the byte holding `position`, which are enough for any chain of tables
+    const ull window { load_big_endian(data + position / CHAR_DIGITS) << (position % CHAR_DIGITS) };
+    const lookup_entry* const table { lookup->data() };
+
+    const lookup_entry* e { &table[window >> (64 - LOOKUP_BITS)] };
+    unsigned used { };
+    while (e->count == 0 && e->width != 0)
     {
-        seq.append(0);
-        traverse(cur->left);
-        seq.pop();
-        seq.append(1);
-        traverse(cur->right);
-        seq.pop();
+        used += e->length;
+        e = &table[e->link + ((window << used) >> (64 - e->width))];
     }
+    if (e->count == 0)
+        throw std::runtime_error { "Invalid code" };
+    memcpy(out, e->symbols, MAX_LOOKUP_SYMBOLS);
+    position += used + e->length;
+    return e->count;
+}
+
+void huffman_encoder::decompress_streams(const char* const data[STREAM_COUNT], const size_t n[STREAM_COUNT], char* out, ull size)
+{   // Streams don't depend on each other, so their lookups overlap in the processor
+    const ull part { stream_part(size) };
+    ull position[STREAM_COUNT] { };     // Bits consumed from every stream
+    ull produced[STREAM_COUNT] { };
+    ull length[STREAM_COUNT];
+    char* dst[STREAM_COUNT];
+
+    for (unsigned s = 0; s < STREAM_COUNT; ++s)
+    {
+        const ull begin { std::min(size, s * part) };
+        length[s] = std::min(part, size - begin);
+        dst[s] = out + begin;
+    }
+    for (;;)
+    {
+        bool room { true };
+        for (unsigned s = 0; s < STREAM_COUNT; ++s)
+            room &= position[s] / CHAR_DIGITS + sizeof(ull) <= n[s] && length[s] - produced[s] >= MAX_LOOKUP_SYMBOLS;
+        if (!room)
+            break;
+        for (unsigned s = 0; s < STREAM_COUNT; ++s)
+            produced[s] += decode_entry(data[s], position[s], dst[s] + produced[s]);
+    }
+    for (unsigned s = 0; s < STREAM_COUNT; ++s)
+    {   // Ends of the streams are decoded one by one
+        size_t pos { static_cast<size_t>(position[s] / CHAR_DIGITS) };
+        init_for_decompressing(length[s] - produced[s]);
+        if (position[s] % CHAR_DIGITS > 0)
+            start_inside(data[s][pos++], position[s] % CHAR_DIGITS);
+        decompress_block(data[s] + pos, n[s] - pos, dst[s] + produced[s], length[s] - produced[s]);
+        if (!finished())
+            throw std::runtime_error { "Stream is truncated" };
+    }
+    file_size = written_bytes = size;
+}
+
+void huffman_encoder::start_inside(char byte, unsigned skip)
+{   // Decoding starts `skip` bits into `byte`, the rest of the payload is passed to decompress_block
+    bits = static_cast<ull>(static_cast<unsigned char>(byte)) << (64 - CHAR_DIGITS + skip);
+    bit_count = CHAR_DIGITS - skip;
+}
+
+void huffman_encoder::set_code_length_limit(unsigned limit)
+{
+    if (limit == 0 || limit > MAX_CODE_LENGTH)
+        throw std::invalid_argument { "Code length limit is out of range" };
+    length_limit = limit;
 }
 
 void huffman_encoder::encode()
 {
-    std::priority_queue<puu, std::vector<puu>, std::greater<puu>> q;
+    huffman_code_lengths(char_count_, code_length_);
+    if (*std::max_element(code_length_, code_length_ + CHAR_RANGE) > length_limit)
+        limit_code_lengths();
+    assign_codes();
+}
 
+huffman_encoder::ull huffman_encoder::payload_size() const
+{
+    ull payload_bits { };
     for (int c = CHAR_MIN; c <= CHAR_MAX; ++c)
+        payload_bits += char_count[c] * code_length[c];
+    return payload_bits / CHAR_DIGITS + (payload_bits % CHAR_DIGITS > 0);
+}
+
+huffman_encoder::ull huffman_encoder::payload_size(const char* data, size_t n) const
+{
+    const ull total { payload_bits(data, n) };
+    return total / CHAR_DIGITS + (total % CHAR_DIGITS > 0);
+}
+
+huffman_encoder::ull huffman_encoder::payload_bits(const char* data, size_t n) const
+{
+    ull res { };
+    for (size_t i = 0; i < n; ++i)
+        res += code_length[static_cast<int>(data[i])];
+    return res;
+}
+
+huffman_encoder::ull huffman_encoder::payload_size(const histogram& h) const
+{
+    ull total { };
+    for (unsigned i = 0; i < CHAR_RANGE; ++i)
     {
-        ull count { char_count[c] };
-        if (count > 0ull)
-            q.push(std::make_pair(count, ptr { new node { static_cast<char>(c) } }));
+        const unsigned length { code_length[static_cast<int>(static_cast<char>(i))] };
+        if (h.counts[i] > 0 && length == 0)
+            return ULLONG_MAX;
+        total += h.counts[i] * length;
     }
-    while (q.size() > 1)
+    return total / CHAR_DIGITS + (total % CHAR_DIGITS > 0);
+}
+
+void huffman_encoder::encode_block(const uint8_t* in, size_t n, bit_writer& out) const
+{
+    for (size_t i = 0; i < n; ++i)
     {
-        puu u { q.top() };
-        q.pop();
-        puu v { q.top() };
-        q.pop();
-        q.push(std::make_pair(u.first + v.first, ptr { new node { u.second, v.second, std::min(u.second->c, v.second->c) } } ));
+        const flat_code& c { flat_codes[in[i]] };
+        out.put(c.bits, c.length);
     }
-    traverse(q.top().second);
 }
 
-bool huffman_encoder::read_header(std::istream& is)
+void huffman_encoder::add_counts(const histogram& h)
 {
-    unsigned unique_chars { };
+    for (unsigned i = 0; i < CHAR_RANGE; ++i)
+        char_count[static_cast<int>(static_cast<char>(i))] += h.counts[i];
+    file_size += h.total;
+}
 
-    is.read(reinterpret_cast<char*>(&unique_chars), sizeof(unsigned));
-    if (unique_chars > CHAR_RANGE)
-        return false;
-    is.read(reinterpret_cast<char*>(&file_size), sizeof(ull));
+void huffman_encoder::copy_table(const huffman_encoder& other)
+{
+    std::copy(other.code_length_, other.code_length_ + CHAR_RANGE, code_length_);
+    length_limit = other.length_limit;
+    sort_symbols();
+    lookup = other.lookup;
+}
 
-    for (unsigned i = 0; i < unique_chars; ++i) {
-        char c;
-        unsigned size;
-        std::vector<char> digits { };
+void huffman_encoder::limit_code_lengths()
+{   // Package-merge: optimal code lengths not exceeding the limit
+    std::vector<std::pair<ull, char>> leaves;
+    for (int c = CHAR_MIN; c <= CHAR_MAX; ++c)
+    {
+        if (char_count[c] > 0)
+            leaves.push_back(std::make_pair(char_count[c], static_cast<char>(c)));
+    }
+    std::sort(leaves.begin(), leaves.end());
 
-        is.read(&c, sizeof(char));
-        is.read(reinterpret_cast<char*>(&size), sizeof(unsigned));
-        unsigned len = size / CHAR_DIGITS + (size % CHAR_DIGITS > 0);
+    unsigned limit { length_limit };
+    while ((size_t { 1 } << limit) < leaves.size())   // Raised as documented at set_code_length_limit
+        ++limit;
 
-        for (unsigned j = 0; j < len; ++j) {
-            char c;
-            is.read(&c, sizeof(char));
-            digits.push_back(c);
+    std::vector<std::vector<bool>> leaf_flags(limit);   // Merged lists from the deepest level, package otherwise
+    std::vector<ull> prev;
+    for (unsigned level = limit; level-- > 0;)
+    {
+        std::vector<ull> cur;
+        size_t i { }, j { };
+        while (i < leaves.size() || j + 1 < prev.size())
+        {
+            if (j + 1 >= prev.size() || (i < leaves.size() && leaves[i].first <= prev[j] + prev[j + 1]))
+            {
+                cur.push_back(leaves[i++].first);
+                leaf_flags[level].push_back(true);
+            }
+            else
+            {
+                cur.push_back(prev[j] + prev[j + 1]);
+                leaf_flags[level].push_back(false);
+                j += 2;
+            }
+        }
+        prev.swap(cur);
+    }
+
+    std::fill(code_length_, code_length_ + CHAR_RANGE, 0);
+    size_t taken { 2 * leaves.size() - 2 };
+    for (unsigned level = 0; level < limit && taken > 0; ++level)
+    {   // Every selected leaf adds one bit to the code of its symbol; selected packages expand to the next level
+        size_t selected_leaves { static_cast<size_t>(std::count(leaf_flags[level].begin(), leaf_flags[level].begin() + taken, true)) };
+        for (size_t k = 0; k < selected_leaves; ++k)
+            ++code_length[static_cast<int>(leaves[k].second)];
+        taken = 2 * (taken - selected_leaves);
+    }
+}
+
+void huffman_encoder::assign_codes()
+{   // Codes of the same length are consecutive binary numbers, ordered by symbols
+    sort_symbols();
+    std::fill(flat_codes, flat_codes + CHAR_RANGE, flat_code { });
+    uint64_t next { };
+    for (unsigned len = 1; len <= max_length; ++len, next <<= 1)
+    {
+        for (unsigned i = 0; i < length_count[len]; ++i, ++next)
+        {
+            const char c { sorted[length_offset[len] + i] };
+            flat_codes[static_cast<unsigned char>(c)] = { static_cast<uint32_t>(next), len };
         }
-        code_table[static_cast<int>(c)] = { size, digits };
-        ca.add(code_table[static_cast<int>(c)], c);
     }
-    if (!is)
-        return false;
-    return true;
 }
 
-void huffman_encoder::write_header(std::ostream& os)
+bool huffman_encoder::read_table(std::istream& is)
 {
-    unsigned unique_chars { };
+    unsigned char limit { };
 
-    for (int c = CHAR_MIN; c <= CHAR_MAX; ++c)
+    is.read(reinterpret_cast<char*>(&limit), sizeof(char));
+    if (limit == 0 || limit > MAX_CODE_LENGTH)
+        return false;
+
+    for (int c = CHAR_MIN; c <= CHAR_MAX && is;)
     {
-        if (char_count[c] > 0)
-            ++unique_chars;
+        unsigned char len { };
+        is.read(reinterpret_cast<char*>(&len), sizeof(char));
+        if (len > 0)
+        {
+            code_length[c++] = len;
+            continue;
+        }
+        unsigned char run { };    // Run of absent symbols, decremented by one
+        is.read(reinterpret_cast<char*>(&run), sizeof(char));
+        if (c + run > CHAR_MAX)
+            return false;
+        std::fill(code_length + c, code_length + c + run + 1, 0);
+        c += run + 1;
+    }
+    if (!is)
+        return false;
+    sort_symbols();
+    lookup.reset();
+    if (max_length > limit)
+        return false;
+    length_limit = limit;
+
+    unsigned left_symbols { length_offset[max_length] + length_count[max_length] };
+    if (left_symbols == 0)
+        return false;
+    if (left_symbols == 1)
+        return max_length == 1;
+    long long free_codes { 1 };      // Kraft inequality must turn into equality
+    for (unsigned len = 1; len <= max_length; ++len)
+    {
+        free_codes = 2 * free_codes - length_count[len];
+        left_symbols -= length_count[len];
+        if (free_codes < 0 || free_codes > left_symbols)
+            return false;
     }
-    os.write(reinterpret_cast<char*>(&unique_chars), sizeof(unsigned));
-    os.write(reinterpret_cast<char*>(&file_size), sizeof(ull));
+    return free_codes == 0;
+}
+
+void huffman_encoder::write_table(std::ostream& os) const
+{
+    const unsigned char limit { static_cast<unsigned char>(std::max(length_limit, max_length)) };
+
+    os.write(reinterpret_cast<const char*>(&limit), sizeof(char));
 
-    for (int i = CHAR_MIN; i <= CHAR_MAX; ++i)
+    for (int c = CHAR_MIN; c <= CHAR_MAX;)
     {
-        if (char_count[i] > 0ull)
+        if (code_length[c] > 0)
         {
-            char c { static_cast<char>(i) };
-            os.write(&c, sizeof(char));
-            os.write(reinterpret_cast<char*>(&code_table[i].size), sizeof(unsigned));
-            for (auto& c : code_table[i].digits) { os.write(&c, sizeof(char)); }
+            os.write(reinterpret_cast<const char*>(&code_length[c]), sizeof(char));
+            ++c;
+            continue;
         }
+        unsigned char run { };
+        while (c + run < CHAR_MAX && code_length[c + run + 1] == 0 && run < UCHAR_MAX)
+            ++run;
+        const char zero { };
+        os.write(&zero, sizeof(char));
+        os.write(reinterpret_cast<const char*>(&run), sizeof(char));
+        c += run + 1;
     }
 }
@@ -1,154 +1,118 @@
 #ifndef HUFFMAN_ENCODER_H
 #define HUFFMAN_ENCODER_H
 
-#include <functional>
 #include <limits>
 #include <vector>
 #include <climits>
 #include <memory>
+#include <stdexcept>
+#include <cstdint>
 
 constexpr unsigned CHAR_RANGE { CHAR_MAX - CHAR_MIN + 1 };
 constexpr unsigned CHAR_DIGITS { CHAR_BIT * sizeof(char) };
 constexpr unsigned BUFFER_SIZE { 64 * 1024 * 1024 };
 constexpr unsigned MAX_BUFFER_LENGTH { CHAR_DIGITS * BUFFER_SIZE };
+constexpr unsigned LOOKUP_BITS { 11 };         // Width of the root table of the table-driven decoder
+constexpr unsigned SUBTABLE_BITS { 8 };        // Maximum width of secondary tables for long codes
+constexpr unsigned MAX_LOOKUP_SYMBOLS { 4 };   // Maximum number of symbols decoded by one lookup
+constexpr unsigned MAX_CODE_LENGTH { 32 };     // Codes are never longer, tighter limit can be set per encoder
+constexpr unsigned STREAM_COUNT { 4 };         // Number of streams of an interleaved block
+
+constexpr unsigned long long stream_part(unsigned long long size)     // Symbols per stream, the last one may get fewer
+{
+    return (size + STREAM_COUNT - 1) / STREAM_COUNT;
+}
+
+struct histogram;
+struct bit_writer;
+
+// Optimal code lengths without a limit, zero for absent symbols. Both arrays are indexed alike: the encoder passes
+// char_count_ and code_length_, indexed by `c - CHAR_MIN` unlike flat_codes; ties go to the smaller index.
+// Works on a fixed array of 2 * CHAR_RANGE nodes, so building a table for every small message allocates nothing
+void huffman_code_lengths(const unsigned long long counts[CHAR_RANGE], unsigned char lengths[CHAR_RANGE]);
 
 struct huffman_encoder
 {
 private:
-    struct node;
     typedef unsigned long long ull;
 public:
-    using ptr = std::shared_ptr<node>;
-    using puu = std::pair<ull, ptr>;
-
-    struct code
-    {
-        unsigned size;  // Size in bits
-        std::vector<char> digits;
-
-        code()
-        : size { }, digits { } { };
-
-        code(const code& other)
-        : size { other.size }, digits { other.digits } { };
-
-        code(unsigned size, std::vector<char> digits)
-        : size { size }, digits { digits } { };
-
-        const char& operator[](unsigned n) const { return digits[n]; }
-
-        void append(char bit)
-        {
-            ++size;
-            if (digits.size() * CHAR_DIGITS < size) digits.push_back(0);
-            if (bit) digits.back() ^= 1 << (CHAR_DIGITS - 1 - (size - 1) % CHAR_DIGITS);
-        }
-
-        void pop()
-        {
-            --size;
-            if ((digits.size() - 1) * CHAR_DIGITS >= size) digits.pop_back();
-            else digits.back() &= (CHAR_RANGE - 1) ^ (1 << (CHAR_DIGITS - 1 - (size) % CHAR_DIGITS));
-        }
-    };
-
-    // --------- Functors for interaction with program --------- //
-
-    std::function<void(char)> compress_first_iteration
-    {
-        [&](char c)
-        {
-            ++char_count[static_cast<int>(c)];
-            ++file_size;
-        }
-    };
 
-    std::function<code(char)> compress_second_iteration
+    struct decode_result
     {
-        [&](char c)
-        {
-            return code_table[static_cast<int>(c)];
-        }
+        size_t consumed;    // Input bytes, bits which weren't decoded yet are kept by the decoder
+        size_t produced;    // Output bytes
     };
 
-    std::function<std::vector<char>(char)> decompress_iteration
+    struct lookup_entry
     {
-        [&](char c)
-        {
-            std::vector<char> res;
-            for (int k = CHAR_DIGITS - 1; k >= 0; --k) {
-                unsigned bit { ((1 << k) & c) > 0 };
-                ca.cur = ca.v[ca.cur].small_links[bit];
-                if (ca.v[ca.cur].small_links[0] == 0 && ca.v[ca.cur].small_links[1] == 0)   // Is leaf
-                {
-                    if (file_size < ++written_bytes) return res;    // Last bit may contain zeroes at the end, which can lead to appearance of extra bytes
-                    res.push_back(ca.v[ca.cur].leaf);
-                    ca.cur = 0;
-                }
-            }
-            return res;
-        }
+        char symbols[MAX_LOOKUP_SYMBOLS];   // Only first `count` symbols are meaningful
+        unsigned char count;                // Zero if code continues in the subtable
+        unsigned char length;               // Bits consumed by the entry
+        unsigned char width;                // Width of the subtable, zero together with zero `count` marks invalid code
+        unsigned link;                      // Offset of the subtable
     };
 
-    // ------------------------------------------------------- //
-
     void init_for_compressing();
-    void init_for_decompressing();
-    void traverse(ptr cur);
+    void init_for_decompressing(ull size);
+    void build_lookup();
+    decode_result decompress_block(const char* data, size_t n, char* out, size_t capacity);
+    void start_inside(char byte, unsigned skip);
+    void decompress_streams(const char* const data[STREAM_COUNT], const size_t n[STREAM_COUNT], char* out, ull size);
+    // A limit too tight for the symbols of a block, more than 2^limit of them, is raised for that block to the
+    // smallest one which codes them all; its table records the raised limit, which the decoder checks codes against
+    void set_code_length_limit(unsigned limit);
     void encode();
-    bool read_header(std::istream& is);
-    void write_header(std::ostream& os);
+    void limit_code_lengths();
+    void assign_codes();
+    void add_counts(const histogram& h);
+    void copy_table(const huffman_encoder& other);      // Lookup of the decoder is shared once either builds it
+    bool read_table(std::istream& is);
+    void write_table(std::ostream& os) const;
+    ull payload_size() const;
+    ull payload_size(const char* data, size_t n) const;
+    ull payload_bits(const char* data, size_t n) const;
+    ull payload_size(const histogram& h) const;     // ULLONG_MAX if some counted symbol has no code
+    void encode_block(const uint8_t* in, size_t n, bit_writer& out) const;
+    std::vector<char> decompress_iteration(char c);     // Bit-at-a-time decoder, only to verify the table-driven one
+    bool finished() const { return written_bytes == file_size; }
+    ull raw_size() const { return file_size; }
+    unsigned pending_bits() const { return bit_count + state.depth; }      // Read by the decoder but not decoded yet
+    unsigned code_length_of(char c) const { return code_length[static_cast<int>(c)]; }     // Zero for absent symbols
 
 private:
 
-    struct node
+    struct flat_code
     {
-        ptr left;
-        ptr right;
-        char c;
-
-        node(char c)
-        : left { }, right { }, c { c } { };
-
-        node(ptr left, ptr right, char c)
-        : left { left }, right { right }, c { c } { };
+        uint32_t bits;      // Code in the lowest bits
+        uint32_t length;
     };
-    struct anode    // Automata node
-    {               // IDEA build automata of CHAR_DIGITS-links; it can be huge, hence it needs to be allocated on heap
-        size_t small_links[2] { };
-        char leaf { };
+    struct canonical_state  // Position inside of the canonical code
+    {
+        unsigned depth;     // Bits consumed
+        unsigned code;      // Consumed bits minus the first code of this length, always less than CHAR_RANGE * 2
     };
 
-    code code_table_[CHAR_RANGE];    // We don't need to default initialize it before every usage
-                                     // as all necessary elements will be reset with new values at every initialization
-    code* code_table { code_table_ - CHAR_MIN };
+    flat_code flat_codes[CHAR_RANGE] { };   // Indexed by unsigned char, zero for absent symbols
     ull char_count_[CHAR_RANGE];     // We NEED to zero this array at every initialization
     ull* char_count { char_count_ - CHAR_MIN };
-    code seq { };
-    ull file_size { };
+    unsigned char code_length_[CHAR_RANGE];
+    unsigned char* code_length { code_length_ - CHAR_MIN };
+    unsigned length_count[CHAR_RANGE] { };   // Number of codes of each length
+    unsigned length_offset[CHAR_RANGE] { };  // Position of the first code of each length in `sorted`
+    char sorted[CHAR_RANGE] { };             // Symbols in canonical order
+    unsigned max_length { };
+    unsigned length_limit { MAX_CODE_LENGTH };
+    ull file_size { };                       // Uncompressed size of the block
     ull written_bytes { };
-    struct
-    {
-        size_t cur;
-        std::vector<anode> v { { } };    // Root is 0
-
-        void add(const code& c, char ch)
-        {
-            cur = 0;
-            for (unsigned i = 0; i < c.size; ++i)
-            {
-                size_t bit { (c.digits[i / CHAR_DIGITS] & (1 << (CHAR_DIGITS - i % CHAR_DIGITS - 1))) != 0 };
-                if (v[cur].small_links[bit] == 0)   // Node is absent
-                {
-                    v[cur].small_links[bit] = v.size();
-                    v.push_back({ });
-                }
-                cur = v[cur].small_links[bit];
-            }
-            v[cur].leaf = ch;
-        }
-    } ca;  // Code automata
-
+    std::shared_ptr<const std::vector<lookup_entry>> lookup { };    // Root table followed by secondary tables, shared by copies
+    ull bits { };                            // Bit buffer of the table-driven decoder, aligned to the most significant bit
+    unsigned bit_count { };
+    canonical_state state { };               // Position the decoder stopped at
+
+    void sort_symbols();
+    bool step(canonical_state& s, unsigned bit, char& c) const;
+    size_t build_table(std::vector<lookup_entry>& table, canonical_state s, unsigned width) const;
+    unsigned decode_entry(const char* data, ull& position, char* out) const;
 };
 
 #endif // HUFFMAN_ENCODER_H
@@ -0,0 +1,668 @@
+#include <algorithm>
+#include <deque>
+#include <new>
+#include <stdexcept>
+#include "huffman_file.h"
+#include "mapped_file.h"
+#include "pipeline.h"
+#include "thread_pool.h"
+#include "crc32c.h"
+
+constexpr unsigned DECODE_CHUNK { 1024 * 1024 };   // Compressed data is read by pieces of this size
+constexpr unsigned WRITE_CHUNK { 1024 * 1024 };   // Decoded data is written by pieces of this size
+
+namespace
+{
+    struct status_error : std::runtime_error    // Carries the status out of the coders, to the function the caller called
+    {
+        explicit status_error(huffman_status status)
+        : std::runtime_error { "Coding failed" }, status { status } { }
+
+        huffman_status status;
+    };
+
+    [[noreturn]] void bad_file(huffman_status status = HUFFMAN_CORRUPTED)
+    {   // Thrown out of the decoder, thread pools join their workers while the input is still there
+        throw status_error { status };
+    }
+
+    void verify_checksum(bool checksummed, uint32_t expected, uint32_t actual)
+    {
+        if (checksummed && actual != expected)
+            bad_file(HUFFMAN_CHECKSUM_MISMATCH);
+    }
+
+    void write(std::ostream& os, const char* data, size_t n)
+    {
+        if (!os.write(data, n))
+            bad_file(HUFFMAN_IO_ERROR);
+    }
+
+    bool valid_file_options(const file_options& opt)
+    {
+        return valid_options(opt) && opt.block_size > 0 && opt.block_size <= BUFFER_SIZE && !(opt.adaptive && opt.shared_table)
+               && (opt.lz77_level == 0 || (!opt.adaptive && !opt.shared_table));
+    }
+
+    template <typename Step>
+    huffman_status guard(Step step)
+    {   // Decoders throw for data they can't decode, the caller gets a status instead
+        try
+        {
+            step();
+        }
+        catch (const status_error& e)
+        {
+            return e.status;
+        }
+        catch (const std::bad_alloc&)
+        {
+            return HUFFMAN_NO_MEMORY;
+        }
+        catch (const std::exception&)
+        {
+            return HUFFMAN_CORRUPTED;
+        }
+        return HUFFMAN_OK;
+    }
+
+    struct file_encoder     // Writes blocks, or keeps them until the size of the file is known, and their index for the end block
+    {
+        file_encoder(std::ostream& os, bool keep)
+        : os { os }, keep { keep } { };
+
+        void write_block(const encoded_block& block)
+        {
+            index.push_back({ block.header.size() + block.payload.size(), block.raw_size, block.checkpoints, block.checksum });
+            if (keep)
+            {
+                kept.push_back(block);
+                return;
+            }
+            write(os, block.header.data(), block.header.size());
+            write(os, block.payload.data(), block.payload.size());
+        }
+
+        std::ostream& os;
+        bool keep;
+        std::vector<block_record> index { };
+        std::vector<encoded_block> kept { };
+    };
+
+    struct input_chunk  // Block of the source, `owner` holds the bytes of blocks read from a stream
+    {
+        std::shared_ptr<std::vector<char>> owner;
+        const char* data;
+        size_t size;
+    };
+
+    std::shared_ptr<huffman_encoder> shared_table(const histogram& counts, const file_options& opt)
+    {
+        auto table = std::make_shared<huffman_encoder>();
+        table->set_code_length_limit(opt.max_code_length);
+        table->init_for_compressing();
+        table->add_counts(counts);
+        if (table->raw_size() > 0)
+            table->encode();
+        return table;
+    }
+
+    std::shared_ptr<huffman_encoder> read_shared_table(std::istream& is, const file_options& opt, thread_pool& pool)
+    {
+        histogram counts { };
+        for (auto data = read_chunk(is, opt.block_size * pool.size()); !data->empty(); data = read_chunk(is, opt.block_size * pool.size()))
+            counts.add_parallel(data->data(), data->size(), pool);
+        is.clear();
+        if (!is.seekg(0, is.beg))
+            bad_file(HUFFMAN_IO_ERROR);     // Source can't be read again
+        return shared_table(counts, opt);
+    }
+
+    void compress_blocks(thread_pool& pool, const std::function<bool(input_chunk&)>& read, const std::shared_ptr<huffman_encoder>& shared,
+                         file_encoder& out, const file_options& opt)
+    {   // Reading, coding and writing overlap: the input is read ahead on its own thread, the pool codes blocks and
+        // a writer thread writes them in order. Block boundaries don't depend on the number of threads, hence neither does the output
+        std::deque<std::pair<input_chunk, std::future<block_tables>>> planned;   // Adaptive blocks before the choice
+        std::shared_ptr<huffman_encoder> previous;  // Table of the last BLOCK_HUFFMAN, adaptive blocks may reuse it
+
+        ordered_writer writer { 2 * pool.size() };
+        auto write_block = [&out](const encoded_block& block) { out.write_block(block); };
+        auto choose = [&]
+        {   // Choice depends on the blocks before, so blocks are chosen in order and coded concurrently
+            const input_chunk chunk { planned.front().first };
+            const block_tables tables { planned.front().second.get() };
+            planned.pop_front();
+            const block_choice choice { choose_block(tables, previous.get(), chunk.size) };
+            if (choice == CHOICE_NEW_TABLE && !tables.tans && !tables.context)
+                previous = tables.huffman;
+            const std::shared_ptr<huffman_encoder> table { previous };
+            return writer.push(pool.submit([chunk, tables, table, choice, &opt]() -> encoded_block
+            {
+                if (choice == CHOICE_STORED)
+                    return encode_stored(chunk.data, chunk.size, opt);
+                if (choice == CHOICE_REUSE)
+                    return encode_huffman(chunk.data, chunk.size, *table, false, false, opt);
+                return encode_with_tables(chunk.data, chunk.size, tables, opt);
+            }), write_block);
+        };
+
+        read_ahead<input_chunk> chunks { 2 * pool.size(), read };
+        bool with_table { true };
+        bool writing { true };      // False once a write failed
+        for (input_chunk chunk { }; writing && chunks.pop(chunk);)
+        {
+            if (opt.adaptive)
+            {
+                planned.emplace_back(chunk, pool.submit([chunk, &opt] { return build_tables(chunk.data, chunk.size, opt); }));
+                if (planned.size() >= pool.size())
+                    writing = choose();
+                continue;
+            }
+            writing = writer.push(pool.submit([chunk, shared, with_table, &opt]
+            {
+                return encode_block(chunk.data, chunk.size, shared.get(), with_table, opt);
+            }), write_block);
+            with_table = false;
+        }
+        while (writing && !planned.empty())
+            writing = choose();
+        writer.finish();
+    }
+
+    struct file_decoder     // State of one decompress_file call
+    {
+        file_decoder(std::istream& is, std::ostream& os, const file_options& opt)
+        : is { is }, os { os }, mapped { dynamic_cast<memory_buf*>(is.rdbuf()) }, opt { opt } { };
+
+        void decompress_blocks();
+
+    private:
+        void write_char_to_buffer(char c)
+        {
+            write_buffer[buffer_counter] = c;
+            if (++buffer_counter == write_buffer.size())
+            {
+                buffer_counter = 0;
+                write(os, write_buffer.data(), write_buffer.size());
+            }
+        }
+
+        void flush_buffer_to_counter()
+        {
+            write(os, write_buffer.data(), buffer_counter);
+            buffer_counter = 0;
+        }
+
+        uint32_t decompress_payload(huffman_encoder& encoder, unsigned long long raw_size, unsigned long long payload_size);
+        uint32_t write_tans_block(tans_encoder& decoder, const char* payload, size_t payload_size, unsigned long long raw_size);
+
+        std::istream& is;
+        std::ostream& os;
+        memory_buf* mapped;     // Input in memory, payloads are decoded in place
+        const file_options& opt;
+        std::vector<char> read_buffer { };
+        std::vector<char> write_buffer { };
+        size_t buffer_counter { };
+    };
+
+    uint32_t file_decoder::decompress_payload(huffman_encoder& encoder, unsigned long long raw_size, unsigned long long payload_size)
+    {   // Payload is read sequentially, so the input doesn't need to be seekable; returns the checksum of the decoded bytes
+        uint32_t checksum { };
+        auto decode = [&](const char* data, size_t n)
+        {
+            if (opt.use_automaton)  // Bit-at-a-time decoder, slow but useful for verification
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    const std::vector<char> decoded { encoder.decompress_iteration(data[i]) };
+                    checksum = crc32c(decoded.data(), decoded.size(), checksum);
+                    for (char c : decoded) { write_char_to_buffer(c); }
+                }
+                return;
+            }
+            for (size_t pos = 0;;)
+            {   // Output isn't full only if the input is exhausted
+                auto res = encoder.decompress_block(data + pos, n - pos, write_buffer.data(), write_buffer.size());
+                pos += res.consumed;
+                checksum = crc32c(write_buffer.data(), res.produced, checksum);
+                write(os, write_buffer.data(), res.produced);
+                if (res.produced < write_buffer.size())
+                    break;
+            }
+        };
+
+        encoder.init_for_decompressing(raw_size);
+        if (!opt.use_automaton)
+            encoder.build_lookup();
+        if (mapped != nullptr)
+        {
+            const char* data { mapped->take(payload_size) };
+            if (data == nullptr)
+                bad_file();
+            decode(data, payload_size);
+        }
+        for (unsigned long long remainder { mapped != nullptr ? 0 : payload_size }; remainder > 0;)
+        {
+            const size_t n { static_cast<size_t>(std::min<unsigned long long>(remainder, DECODE_CHUNK)) };
+            read_buffer.resize(DECODE_CHUNK);
+            is.read(read_buffer.data(), n);
+            if (!is)
+                bad_file();
+            remainder -= n;
+            decode(read_buffer.data(), n);
+        }
+        if (!encoder.finished())
+            bad_file();
+        return checksum;
+    }
+
+    uint32_t file_decoder::write_tans_block(tans_encoder& decoder, const char* payload, size_t payload_size, unsigned long long raw_size)
+    {   // Every state is valid, so corrupted data show up only as reads past the payload or a wrong final state
+        uint32_t checksum { };
+        decoder.init_for_decompressing(payload, payload_size);
+        for (unsigned long long done = 0; done < raw_size; done += write_buffer.size())
+        {
+            const size_t n { static_cast<size_t>(std::min<unsigned long long>(raw_size - done, write_buffer.size())) };
+            decoder.decompress_block(write_buffer.data(), n);
+            if (decoder.exhausted())
+                bad_file();
+            checksum = crc32c(write_buffer.data(), n, checksum);
+            write(os, write_buffer.data(), n);
+        }
+        if (!decoder.finished())
+            bad_file();
+        return checksum;
+    }
+
+    void file_decoder::decompress_blocks()
+    {   // Checksums are computed as blocks are decoded, the decoded data aren't read again
+        char magic[MAGIC_SIZE];
+        is.read(magic, MAGIC_SIZE);
+        if (!is || !std::equal(magic, magic + MAGIC_SIZE, FORMAT_MAGIC))
+            bad_file();
+
+        decoder_tables tables;
+        std::unique_ptr<thread_pool> pool { opt.threads > 1 && !opt.use_automaton ? new thread_pool { opt.threads } : nullptr };
+        std::unique_ptr<ordered_writer> writer { pool ? new ordered_writer { 2 * pool->size() } : nullptr };    // Owns the output while it exists
+
+        uint32_t file_checksum { };     // Chained from the checksums in block headers
+        write_buffer.resize(WRITE_CHUNK);
+        buffer_counter = 0;
+        for (block_info block { }; ; )
+        {
+            if (!read_block_header(is, block, tables))
+                bad_file();
+            if (block.type == BLOCK_END)
+            {
+                verify_checksum(block.checksummed, file_checksum, block.checksum);
+                break;
+            }
+            if (block.checksummed)
+                file_checksum = chain_checksum(file_checksum, block.checksum);
+            const int type { block.type };
+            const bool interleaved { block.interleaved };
+            const unsigned long long raw_size { block.raw_size };
+            unsigned long long payload_size { block.payload_size };
+
+            if (!pool && type == BLOCK_STORED)
+            {   // Stored bytes are copied by pieces in order with the decoded ones
+                uint32_t copied { };
+                flush_buffer_to_counter();
+                for (size_t n; payload_size > 0; payload_size -= n)
+                {
+                    n = static_cast<size_t>(std::min<unsigned long long>(payload_size, write_buffer.size()));
+                    if (!is.read(write_buffer.data(), n))
+                        bad_file();
+                    copied = crc32c(write_buffer.data(), n, copied);
+                    write(os, write_buffer.data(), n);
+                }
+                verify_checksum(block.checksummed, block.checksum, copied);
+                continue;
+            }
+            if (!pool && !interleaved && (type == BLOCK_HUFFMAN || type == BLOCK_REUSE))
+            {
+                verify_checksum(block.checksummed, block.checksum, decompress_payload(*tables.huffman, raw_size, payload_size));
+                continue;
+            }
+            std::shared_ptr<std::vector<char>> payload;     // Mapped payloads are decoded in place
+            const char* data { mapped != nullptr ? mapped->take(payload_size) : nullptr };
+            if (mapped == nullptr)
+            {
+                payload = read_chunk(is, payload_size);
+                data = payload->size() == payload_size ? payload->data() : nullptr;
+            }
+            if (data == nullptr)
+                bad_file();
+            if (type == BLOCK_TANS && (!pool || raw_size > payload_size * CHAR_DIGITS))
+            {   // Blocks which may decode to much more than their payload are written by pieces
+                const std::shared_ptr<tans_encoder> decoder { tables.tans };
+                auto stream = [this, block, decoder, payload, data]
+                {
+                    verify_checksum(block.checksummed, block.checksum, write_tans_block(*decoder, data, block.payload_size, block.raw_size));
+                };
+                if (writer)
+                {
+                    if (!writer->push(stream))
+                        break;
+                    continue;
+                }
+                flush_buffer_to_counter();
+                stream();
+                continue;
+            }
+            const block_options& options { opt };
+            auto decode = [block, tables, payload, data, &options]() -> std::vector<char>
+            {   // Checksum is computed by the same thread right after decoding, while the block is in its cache
+                std::vector<char> res { decode_payload(block, tables, data, options) };
+                verify_checksum(block.checksummed, block.checksum, crc32c(res.data(), res.size()));
+                return res;
+            };
+            if (!pool)
+            {   // Streams of a block are decoded together, other coders need the whole payload too
+                flush_buffer_to_counter();
+                const std::vector<char> decoded { decode() };
+                write(os, decoded.data(), decoded.size());
+                continue;
+            }
+            if (!writer->push(pool->submit(decode), [this](const std::vector<char>& decoded) { write(os, decoded.data(), decoded.size()); }))
+                break;
+        }
+        if (writer)
+            writer->finish();
+        flush_buffer_to_counter();
+    }
+}
+
+std::shared_ptr<std::vector<char>> read_chunk(std::istream& is, unsigned long long size)
+{
+    auto data = std::make_shared<std::vector<char>>();
+    while (size > 0 && is)
+    {
+        const size_t n { static_cast<size_t>(std::min<unsigned long long>(size, DECODE_CHUNK)) };
+        data->resize(data->size() + n);
+        is.read(data->data() + data->size() - n, n);
+        data->resize(data->size() - n + is.gcount());
+        size -= is.gcount();
+    }
+    return data;
+}
+
+huffman_status compress_file(std::istream& is, std::ostream& os, const file_options& opt)
+{
+    if (!valid_file_options(opt))
+        return HUFFMAN_BAD_CALL;
+    return guard([&]
+    {
+        if (is.peek() == std::istream::traits_type::eof())     // Empty files have no blocks
+            return;
+        thread_pool pool { std::max(opt.threads, 1u) };
+        const std::shared_ptr<huffman_encoder> shared { opt.shared_table ? read_shared_table(is, opt, pool) : nullptr };
+        file_encoder out { os, false };
+        write(os, FORMAT_MAGIC, MAGIC_SIZE);
+        compress_blocks(pool, [&is, &opt](input_chunk& chunk)
+        {
+            chunk.owner = read_chunk(is, opt.block_size);
+            chunk.data = chunk.owner->data();
+            chunk.size = chunk.owner->size();
+            return chunk.size > 0;
+        }, shared, out, opt);
+        const std::string end { end_block(out.index, opt.checkpoint_interval) };
+        write(os, end.data(), end.size());
+    });
+}
+
+huffman_status compress_whole(const char* data, size_t n, std::ostream& os, const file_options& opt,
+                              const std::function<char*(unsigned long long)>& reserve)
+{   // Blocks are those compress_file makes of the same bytes, they are kept until the size of the file is known
+    if (!valid_file_options(opt))
+        return HUFFMAN_BAD_CALL;
+    return guard([&]
+    {
+        if (n == 0)
+            return;
+        thread_pool pool { std::max(opt.threads, 1u) };
+        std::shared_ptr<huffman_encoder> shared;
+        if (opt.shared_table)
+        {
+            histogram counts { };
+            counts.add_parallel(data, n, pool);
+            shared = shared_table(counts, opt);
+        }
+        file_encoder out { os, true };
+        size_t pos { };
+        compress_blocks(pool, [data, n, &pos, &opt](input_chunk& chunk)
+        {
+            chunk.data = data + pos;
+            chunk.size = std::min<size_t>(opt.block_size, n - pos);
+            pos += chunk.size;
+            return chunk.size > 0;
+        }, shared, out, opt);
+        const std::string end { end_block(out.index, opt.checkpoint_interval) };
+
+        unsigned long long size { MAGIC_SIZE + end.size() };
+        for (auto& b : out.index) { size += b.packed_size; }
+        char* dst { reserve ? reserve(size) : nullptr };
+        auto put = [&](const char* p, size_t k)
+        {
+            if (dst == nullptr)
+                write(os, p, k);
+            else
+                dst = std::copy(p, p + k, dst);
+        };
+        put(FORMAT_MAGIC, MAGIC_SIZE);
+        for (auto& block : out.kept)
+        {
+            put(block.header.data(), block.header.size());
+            put(block.payload.data(), block.payload.size());
+        }
+        put(end.data(), end.size());
+    });
+}
+
+huffman_status decompress_file(std::istream& is, std::ostream& os, const file_options& opt)
+{   // Decoding stops at the first error, data decoded before it are kept in the output
+    if (!valid_file_options(opt))
+        return HUFFMAN_BAD_CALL;
+    return guard([&]
+    {
+        if (is.peek() == std::istream::traits_type::eof())     // Empty files have no blocks
+            return;
+        file_decoder decoder { is, os, opt };
+        decoder.decompress_blocks();
+    });
+}
+
+huffman_status decompress_range(const char* data, size_t size, unsigned long long offset, unsigned long long length, std::ostream& out)
+{   // Only blocks overlapping the range are decoded, each one from the closest checkpoint preceding the range
+    return guard([&]
+    {
+        memory_buf buf { };
+        std::istream in { &buf };
+        unsigned long long index_offset { }, count { }, interval { };
+
+        if (size == 0)
+            return;
+        if (size < MAGIC_SIZE + INDEX_OFFSET_SIZE || !std::equal(data, data + MAGIC_SIZE, FORMAT_MAGIC))
+            bad_file();     // Not a compressed file
+        index_offset = read_index_offset(data + size - INDEX_OFFSET_SIZE);
+        if (index_offset < MAGIC_SIZE + 1 || index_offset > size - INDEX_OFFSET_SIZE)
+            bad_file();     // Index is out of the file
+        buf.reset(const_cast<char*>(data) + index_offset, size - INDEX_OFFSET_SIZE - index_offset);
+        if (!read_varint(in, count) || !read_varint(in, interval))
+            bad_file();
+
+        std::vector<block_record> blocks;
+        std::vector<unsigned long long> starts;     // Positions of blocks in the file
+        for (unsigned long long i = 0, pos = MAGIC_SIZE; i < count; ++i)
+        {
+            block_record b { };
+            if (!read_varint(in, b.packed_size) || !read_varint(in, b.raw_size) || b.packed_size > index_offset - 1 - pos)
+                bad_file();
+            for (unsigned long long k = 0, bits = 0; interval > 0 && b.raw_size > 0 && k < (b.raw_size - 1) / interval; ++k)
+            {
+                unsigned long long distance;
+                if (!read_varint(in, distance))
+                    bad_file();
+                b.checkpoints.push_back(bits += distance);
+            }
+            starts.push_back(pos);
+            pos += b.packed_size;
+            blocks.push_back(b);
+        }
+
+        bool interleaved { }, checksummed { };
+        uint32_t checksum { };
+        auto open_block = [&](size_t i, unsigned long long& payload_size)
+        {   // Leaves the stream at the table or at the payload of the block
+            unsigned long long raw_size;
+            buf.reset(const_cast<char*>(data) + starts[i], blocks[i].packed_size);
+            in.clear();
+            const int type { in.get() };
+            if (!read_varint(in, raw_size) || !read_varint(in, payload_size) || raw_size != blocks[i].raw_size)
+                bad_file();
+            interleaved = (type & BLOCK_INTERLEAVED) != 0;
+            checksummed = (type & BLOCK_CHECKSUM) != 0;
+            if (checksummed && !read_checksum(in, checksum))
+                bad_file();
+            return type & ~(BLOCK_INTERLEAVED | BLOCK_CHECKSUM);
+        };
+        std::shared_ptr<huffman_encoder> table;
+        size_t table_block { blocks.size() };    // Block the table was read from
+        std::vector<char> decoded;
+        unsigned long long raw_start { };
+
+        for (size_t i = 0; i < blocks.size() && length > 0; raw_start += blocks[i++].raw_size)
+        {
+            if (offset >= raw_start + blocks[i].raw_size)
+                continue;
+            const block_record& b { blocks[i] };
+            unsigned long long from { offset - raw_start };
+            const unsigned long long to { from + std::min(length, b.raw_size - from) };
+            offset += to - from;
+            length -= to - from;
+
+            unsigned long long payload_size;
+            size_t j { i };
+            int type { open_block(j, payload_size) };
+            const bool whole { from == 0 && to == b.raw_size };
+            const bool block_checksummed { checksummed };   // Opening the blocks before it for their table overwrites both
+            const uint32_t block_checksum { checksum };
+            if (type == BLOCK_STORED)
+            {
+                const char* payload { buf.take(payload_size) };
+                if (payload == nullptr || payload_size != b.raw_size || interleaved)
+                    bad_file();
+                if (whole)
+                    verify_checksum(checksummed, checksum, crc32c(payload, payload_size));
+                write(out, payload + from, to - from);
+                continue;
+            }
+            if (type == BLOCK_TANS)
+            {   // State of the coder isn't reset anywhere, so the block is decoded from its start
+                tans_encoder decoder { };
+                const char* payload { decoder.read_table(in) ? buf.take(payload_size) : nullptr };
+                if (payload == nullptr)
+                    bad_file();
+                decoder.init_for_decompressing(payload, payload_size);
+                for (unsigned long long skipped = 0; skipped < from; skipped += decoded.size())
+                {
+                    decoded.resize(std::min<unsigned long long>(from - skipped, WRITE_CHUNK));
+                    decoder.decompress_block(decoded.data(), decoded.size());
+                }
+                decoded.resize(to - from);
+                decoder.decompress_block(decoded.data(), decoded.size());
+                if (decoder.exhausted() || (to == b.raw_size && !decoder.finished()))
+                    bad_file();
+                if (whole)
+                    verify_checksum(checksummed, checksum, crc32c(decoded.data(), decoded.size()));
+                write(out, decoded.data(), decoded.size());
+                continue;
+            }
+            if (type == BLOCK_LZ77)
+            {   // Matches reach back anywhere in the block, so the whole block is decoded
+                const char* payload { buf.take(payload_size) };
+                if (payload == nullptr || interleaved || b.raw_size > BUFFER_SIZE)
+                    bad_file();
+                decoded.resize(b.raw_size);
+                decode_lz77_block(payload, payload_size, b.raw_size, decoded.data());
+                verify_checksum(checksummed, checksum, crc32c(decoded.data(), decoded.size()));
+                write(out, decoded.data() + from, to - from);
+                continue;
+            }
+            if (type == BLOCK_CONTEXT)
+            {   // Symbols depend on the ones before, so the whole block is decoded
+                context_model model { };
+                const char* payload { model.read_table(in) ? buf.take(payload_size) : nullptr };
+                if (payload == nullptr || interleaved || b.raw_size > payload_size * CHAR_DIGITS)
+                    bad_file();
+                decoded.resize(b.raw_size);
+                if (!model.decompress_block(payload, payload_size, decoded.data(), decoded.size()))
+                    bad_file();
+                verify_checksum(checksummed, checksum, crc32c(decoded.data(), decoded.size()));
+                write(out, decoded.data() + from, to - from);
+                continue;
+            }
+            while (type != BLOCK_HUFFMAN && j != table_block)
+            {   // Table of BLOCK_REUSE is in the closest preceding BLOCK_HUFFMAN
+                if (type != BLOCK_REUSE && type != BLOCK_TANS && type != BLOCK_STORED && type != BLOCK_CONTEXT && type != BLOCK_LZ77)
+                    bad_file();     // Unknown block type
+                if (j-- == 0)
+                    bad_file();     // Block has no table
+                type = open_block(j, payload_size);
+            }
+            if (j != table_block)
+            {
+                table = std::make_shared<huffman_encoder>();
+                if (!table->read_table(in))
+                    bad_file();
+                table->build_lookup();      // Streams of the range share it
+                table_block = j;
+            }
+            if (j != i)
+                open_block(i, payload_size);
+            const char* payload { buf.take(payload_size) };
+            if (payload == nullptr)
+                bad_file();
+
+            const char* streams[STREAM_COUNT] { payload };
+            size_t sizes[STREAM_COUNT] { static_cast<size_t>(payload_size) };
+            if (interleaved && !split_streams(payload, payload_size, streams, sizes))
+                bad_file();     // Jump table is corrupted
+
+            const unsigned long long part { interleaved ? stream_part(b.raw_size) : b.raw_size };
+            uint32_t written { };   // Checksum of the decoded range, streams follow each other in the block
+            for (unsigned s = static_cast<unsigned>(from / part); from < to; ++s)
+            {   // Range may span several streams, each one is decoded from its closest checkpoint
+                const unsigned long long stop { std::min(to, (s + 1) * part) };
+                const unsigned long long stream_begin { static_cast<unsigned long long>(streams[s] - payload) * CHAR_DIGITS };
+                const unsigned long long stream_end { stream_begin + sizes[s] * CHAR_DIGITS };
+                const size_t k { interval > 0 ? static_cast<size_t>(std::min<unsigned long long>(from / interval, b.checkpoints.size())) : 0 };
+                unsigned long long start { s * part }, bit { stream_begin };
+                if (k > 0 && k * interval >= start)
+                {
+                    start = k * interval;
+                    bit = b.checkpoints[k - 1];
+                }
+                if (bit < stream_begin || bit >= stream_end)
+                    bad_file();     // Checkpoint is out of the stream
+
+                huffman_encoder decoder { };
+                decoder.copy_table(*table);
+                decoder.init_for_decompressing(stop - start);
+                decoder.build_lookup();
+                size_t pos { static_cast<size_t>(bit / CHAR_DIGITS) };
+                if (bit % CHAR_DIGITS > 0)
+                    decoder.start_inside(payload[pos++], bit % CHAR_DIGITS);
+                decoded.resize(stop - start);
+                decoder.decompress_block(payload + pos, stream_end / CHAR_DIGITS - pos, decoded.data(), decoded.size());
+                if (!decoder.finished())
+                    bad_file();     // Stream is truncated
+                write(out, decoded.data() + (from - start), stop - from);
+                written = crc32c(decoded.data() + (from - start), stop - from, written);
+                from = stop;
+            }
+            if (whole)
+                verify_checksum(block_checksummed, block_checksum, written);
+        }
+    });
+}
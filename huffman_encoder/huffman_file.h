@@ -0,0 +1,43 @@
+#ifndef HUFFMAN_FILE_H
+#define HUFFMAN_FILE_H
+
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "huffman_stream.h"
+
+/*
+    Files of the tool coded between streams, with the threads and tables the tool offers. State is kept per call,
+    so several files may be coded at once. Errors are returned like those of the one-call functions in huffman_stream.h;
+    output written before an error is left in the stream.
+
+        compress_file(is, os, opt);             source read once, block by block
+        compress_whole(data, n, os, opt, reserve);    source in memory, e.g. a mapped file, in the same blocks
+        decompress_file(is, os, opt);           streams over a memory_buf are decoded in place
+        decompress_range(data, n, offset, length, os);    only the blocks of the range, found through the index
+*/
+
+struct file_options : block_options
+{
+    bool shared_table { false };    // One table for all blocks, the source is read twice
+    bool adaptive { false };        // Every block takes a new table, the previous one or is stored, whichever is smaller
+    unsigned block_size { DEFAULT_STREAM_BLOCK };
+    unsigned threads { 0 };         // Zero and one code a block at a time, output doesn't depend on it
+};
+
+// Memory grows only as data actually arrive, so corrupted sizes can't exhaust it
+std::shared_ptr<std::vector<char>> read_chunk(std::istream& is, unsigned long long size);
+
+huffman_status compress_file(std::istream& is, std::ostream& os, const file_options& opt);
+// Output is the one of compress_file. It goes to the memory `reserve` returns for its final size, e.g. a mapped file,
+// or to `os` if it returns null
+huffman_status compress_whole(const char* data, size_t n, std::ostream& os, const file_options& opt,
+                              const std::function<char*(unsigned long long)>& reserve);
+huffman_status decompress_file(std::istream& is, std::ostream& os, const file_options& opt);
+// Checksums are verified for the blocks decoded whole
+huffman_status decompress_range(const char* data, size_t n, unsigned long long offset, unsigned long long length, std::ostream& os);
+
+#endif // HUFFMAN_FILE_H
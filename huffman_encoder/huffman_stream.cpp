@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include "huffman_stream.h"
+#include "huffman_file.h"
+#include "mapped_file.h"
+#include "crc32c.h"
+
+struct huffman_context
+{
+    huffman_context(bool compressing, const block_options& opt, unsigned block_size)
+    : compressing { compressing }, opt { opt }, block_size { block_size } { };
+
+    bool compressing;
+    block_options opt;
+    unsigned block_size;
+    huffman_status status { HUFFMAN_OK };
+    std::vector<char> input { };        // Raw bytes of the next block, or compressed bytes which weren't decoded yet
+    size_t input_pos { };               // Compressed bytes before it are decoded, or parsed as the header of the next block
+    std::vector<char> output { };
+    size_t output_pos { };              // Bytes before it were handed out
+    std::vector<block_record> blocks { };       // Index of the compressor
+    bool started { };                   // Magic was read
+    decoder_tables tables { };
+    uint32_t file_checksum { };
+    bool have_header { };               // Header of the next block was parsed, its payload at `input_pos` is awaited
+    block_info block { };
+    decoder_tables block_tables { };    // Tables of that block, kept once it's decoded
+};
+
+namespace
+{
+    huffman_context* create(bool compressing, const block_options* opt, unsigned block_size)
+    {
+        const block_options options { opt != nullptr ? *opt : block_options { } };
+        if (!valid_options(options) || block_size > BUFFER_SIZE)
+            return nullptr;
+        return new (std::nothrow) huffman_context(compressing, options, block_size > 0 ? block_size : DEFAULT_STREAM_BLOCK);
+    }
+
+    void append(std::vector<char>& v, const char* data, size_t n)
+    {
+        v.insert(v.end(), data, data + n);
+    }
+
+    size_t hand_out(huffman_context* ctx, char* out, size_t out_cap)
+    {
+        const size_t n { std::min(out_cap, ctx->output.size() - ctx->output_pos) };
+        if (n > 0)
+            memcpy(out, ctx->output.data() + ctx->output_pos, n);
+        ctx->output_pos += n;
+        if (ctx->output_pos == ctx->output.size())
+        {
+            ctx->output.clear();
+            ctx->output_pos = 0;
+        }
+        return n;
+    }
+
+    void write_block(huffman_context* ctx)
+    {   // Every block takes its own table, as blocks of the tool's streaming mode
+        const encoded_block block { encode_block(ctx->input, nullptr, true, ctx->opt) };
+        append(ctx->output, block.header.data(), block.header.size());
+        append(ctx->output, block.payload.data(), block.payload.size());
+        ctx->blocks.push_back({ block.header.size() + block.payload.size(), block.raw_size, block.checkpoints, block.checksum });
+        ctx->input.clear();
+    }
+
+    void decode_blocks(huffman_context* ctx)
+    {   // Headers are parsed once they arrived whole, payloads are decoded once they did
+        memory_buf buf { };
+        std::istream is { &buf };
+        if (!ctx->started)
+        {
+            if (ctx->input.size() < MAGIC_SIZE)
+                return;
+            if (!std::equal(FORMAT_MAGIC, FORMAT_MAGIC + MAGIC_SIZE, ctx->input.data()))
+            {
+                ctx->status = HUFFMAN_CORRUPTED;
+                return;
+            }
+            ctx->input_pos = MAGIC_SIZE;
+            ctx->started = true;
+        }
+        while (ctx->status == HUFFMAN_OK)
+        {
+            const block_info& block { ctx->block };
+            if (!ctx->have_header)
+            {
+                ctx->block_tables = ctx->tables;
+                buf.reset(ctx->input.data() + ctx->input_pos, ctx->input.size() - ctx->input_pos);
+                is.clear();
+                if (!read_block_header(is, ctx->block, ctx->block_tables))
+                {
+                    ctx->status = is.eof() ? HUFFMAN_OK : HUFFMAN_CORRUPTED;
+                    break;
+                }
+                if (block.type == BLOCK_END)
+                {   // Index after the end block isn't needed to decode the file
+                    ctx->status = block.checksummed && block.checksum != ctx->file_checksum ? HUFFMAN_CHECKSUM_MISMATCH : HUFFMAN_FINISHED;
+                    ctx->input.clear();
+                    ctx->input_pos = 0;
+                    return;
+                }
+                ctx->input_pos += buf.consumed();
+                ctx->have_header = true;
+            }
+            if (ctx->input.size() - ctx->input_pos < block.payload_size)
+                break;
+            const std::vector<char> decoded { decode_payload(block, ctx->block_tables, ctx->input.data() + ctx->input_pos, ctx->opt) };
+            if (block.checksummed && crc32c(decoded.data(), decoded.size()) != block.checksum)
+            {
+                ctx->status = HUFFMAN_CHECKSUM_MISMATCH;
+                return;
+            }
+            if (block.checksummed)
+                ctx->file_checksum = chain_checksum(ctx->file_checksum, block.checksum);
+            append(ctx->output, decoded.data(), decoded.size());
+            ctx->tables = ctx->block_tables;
+            ctx->input_pos += static_cast<size_t>(block.payload_size);
+            ctx->have_header = false;
+        }
+        ctx->input.erase(ctx->input.begin(), ctx->input.begin() + ctx->input_pos);
+        ctx->input_pos = 0;
+    }
+
+    struct array_buf : std::streambuf   // Output stream into the caller's buffer, it fails once the buffer is full
+    {
+        array_buf(char* data, size_t size) { setp(data, data + size); }
+
+        size_t size() const { return pptr() - pbase(); }
+    };
+
+    template <typename Step>
+    huffman_status run_whole(Step step)
+    {   // One-call functions keep no context, their errors are returned
+        try
+        {
+            return step();
+        }
+        catch (const std::bad_alloc&)
+        {
+            return HUFFMAN_NO_MEMORY;
+        }
+        catch (const std::exception&)
+        {
+            return HUFFMAN_CORRUPTED;
+        }
+    }
+
+    template <typename Block>
+    huffman_status for_each_block(const char* in, size_t in_len, Block visit)
+    {   // Input is only read, the buffer just lets the parser see it as a stream
+        memory_buf buf { };
+        std::istream is { &buf };
+        decoder_tables tables { };
+        if (in_len == 0)    // Empty files of the tool have no blocks
+            return HUFFMAN_OK;
+        buf.reset(const_cast<char*>(in), in_len);
+        const char* magic { buf.take(MAGIC_SIZE) };
+        if (magic == nullptr || !std::equal(FORMAT_MAGIC, FORMAT_MAGIC + MAGIC_SIZE, magic))
+            return HUFFMAN_CORRUPTED;
+        for (block_info block { }; ; )
+        {
+            if (!read_block_header(is, block, tables))
+                return HUFFMAN_CORRUPTED;
+            const char* payload { block.type == BLOCK_END ? nullptr : buf.take(block.payload_size) };
+            if (block.type != BLOCK_END && payload == nullptr)
+                return HUFFMAN_CORRUPTED;
+            const huffman_status status { visit(block, tables, payload) };
+            if (status != HUFFMAN_OK || block.type == BLOCK_END)
+                return status;
+        }
+    }
+
+    template <typename Step>
+    size_t run(huffman_context* ctx, bool compressing, char* out, size_t out_cap, Step step)
+    {   // Errors are kept in the context, nothing is thrown to the caller
+        if (ctx->compressing != compressing)
+            ctx->status = HUFFMAN_BAD_CALL;
+        try
+        {
+            if (ctx->status == HUFFMAN_OK)
+                step();
+        }
+        catch (const std::bad_alloc&)
+        {
+            ctx->status = HUFFMAN_NO_MEMORY;
+        }
+        catch (const std::exception&)
+        {   // Decoders throw for data they can't decode
+            ctx->status = HUFFMAN_CORRUPTED;
+        }
+        return hand_out(ctx, out, out_cap);
+    }
+}
+
+huffman_context* huffman_compressor(const block_options* opt, unsigned block_size)
+{
+    huffman_context* ctx { create(true, opt, block_size) };
+    if (ctx != nullptr)
+        append(ctx->output, FORMAT_MAGIC, MAGIC_SIZE);
+    return ctx;
+}
+
+huffman_context* huffman_decompressor(const block_options* opt)
+{
+    return create(false, opt, 0);
+}
+
+void huffman_free(huffman_context* ctx)
+{
+    delete ctx;
+}
+
+size_t compress_stream(huffman_context* ctx, const char* in, size_t in_len, char* out, size_t out_cap)
+{
+    return run(ctx, true, out, out_cap, [&]
+    {
+        while (in_len > 0)
+        {
+            const size_t n { std::min<size_t>(in_len, ctx->block_size - ctx->input.size()) };
+            append(ctx->input, in, n);
+            in += n;
+            in_len -= n;
+            if (ctx->input.size() == ctx->block_size)
+                write_block(ctx);
+        }
+    });
+}
+
+size_t compress_end(huffman_context* ctx, char* out, size_t out_cap)
+{   // Once ended, calls only hand out the rest of the output
+    return run(ctx, true, out, out_cap, [&]
+    {
+        if (!ctx->input.empty())
+            write_block(ctx);
+        const std::string end { end_block(ctx->blocks, ctx->opt.checkpoint_interval) };
+        append(ctx->output, end.data(), end.size());
+        ctx->status = HUFFMAN_FINISHED;
+    });
+}
+
+size_t decompress_stream(huffman_context* ctx, const char* in, size_t in_len, char* out, size_t out_cap)
+{
+    return run(ctx, false, out, out_cap, [&]
+    {
+        if (in_len == 0)
+            return;
+        append(ctx->input, in, in_len);
+        decode_blocks(ctx);
+    });
+}
+
+size_t huffman_pending(const huffman_context* ctx)
+{
+    return ctx->output.size() - ctx->output_pos;
+}
+
+huffman_status huffman_get_status(const huffman_context* ctx)
+{
+    return ctx->status;
+}
+
+size_t compress_bound(size_t n, const block_options* opt, unsigned block_size)
+{   // Every block is at most a stored one, each checkpoint delta at most the bits of its block
+    const block_options options { opt != nullptr ? *opt : block_options { } };
+    if (!valid_options(options) || block_size > BUFFER_SIZE)
+        return 0;
+    if (block_size == 0)
+        block_size = DEFAULT_STREAM_BLOCK;
+    auto block_bound = [&options](size_t k)
+    {
+        const size_t packed { stored_block_size(k) };
+        return packed + varint_size(packed) + varint_size(k) + checkpoint_count(k, options) * varint_size(packed * CHAR_DIGITS);
+    };
+    const size_t blocks { n / block_size + (n % block_size > 0) };
+    return MAGIC_SIZE + n / block_size * block_bound(block_size) + (n % block_size > 0 ? block_bound(n % block_size) : 0)
+           + 1 + CHECKSUM_SIZE + varint_size(blocks) + varint_size(options.checkpoint_interval) + INDEX_OFFSET_SIZE;
+}
+
+huffman_status huffman_compress(const char* in, size_t in_len, char* out, size_t out_cap, size_t* out_len, const block_options* opt,
+                                unsigned block_size)
+{
+    const block_options options { opt != nullptr ? *opt : block_options { } };
+    *out_len = 0;
+    if (!valid_options(options) || block_size > BUFFER_SIZE)
+        return HUFFMAN_BAD_CALL;
+    if (block_size == 0)
+        block_size = DEFAULT_STREAM_BLOCK;
+    return run_whole([&]
+    {
+        std::vector<block_record> blocks;
+        if (out_cap < MAGIC_SIZE)
+            return HUFFMAN_OUTPUT_FULL;
+        *out_len = std::copy(FORMAT_MAGIC, FORMAT_MAGIC + MAGIC_SIZE, out) - out;
+        for (size_t pos = 0; pos < in_len; pos += block_size)
+        {
+            block_record record { };
+            const size_t written { encode_block_to(in + pos, std::min<size_t>(block_size, in_len - pos), options, out + *out_len,
+                                                   out_cap - *out_len, record) };
+            if (written == 0)
+                return HUFFMAN_OUTPUT_FULL;
+            *out_len += written;
+            blocks.push_back(record);
+        }
+        const std::string end { end_block(blocks, options.checkpoint_interval) };
+        if (end.size() > out_cap - *out_len)
+            return HUFFMAN_OUTPUT_FULL;
+        *out_len += std::copy(end.begin(), end.end(), out + *out_len) - (out + *out_len);
+        return HUFFMAN_OK;
+    });
+}
+
+huffman_status huffman_decompressed_size(const char* in, size_t in_len, unsigned long long* size)
+{   // Payloads are skipped, though tables are still parsed on the way
+    *size = 0;
+    return run_whole([&]
+    {
+        return for_each_block(in, in_len, [size](const block_info& block, const decoder_tables&, const char*)
+        {
+            *size += block.raw_size;
+            return HUFFMAN_OK;
+        });
+    });
+}
+
+huffman_status huffman_decompress(const char* in, size_t in_len, char* out, size_t out_cap, size_t* out_len, const block_options* opt)
+{
+    const block_options options { opt != nullptr ? *opt : block_options { } };
+    uint32_t file_checksum { };
+    *out_len = 0;
+    if (!valid_options(options))
+        return HUFFMAN_BAD_CALL;
+    return run_whole([&]
+    {
+        return for_each_block(in, in_len, [&](const block_info& block, const decoder_tables& tables, const char* payload)
+        {
+            if (block.type == BLOCK_END)
+                return block.checksummed && block.checksum != file_checksum ? HUFFMAN_CHECKSUM_MISMATCH : HUFFMAN_OK;
+            if (block.raw_size > out_cap - *out_len)
+                return HUFFMAN_OUTPUT_FULL;
+            decode_payload(block, tables, payload, options, out + *out_len);
+            if (block.checksummed && crc32c(out + *out_len, block.raw_size) != block.checksum)
+                return HUFFMAN_CHECKSUM_MISMATCH;
+            if (block.checksummed)
+                file_checksum = chain_checksum(file_checksum, block.checksum);
+            *out_len += block.raw_size;
+            return HUFFMAN_OK;
+        });
+    });
+}
+
+huffman_status huffman_decompress_range(const char* in, size_t in_len, unsigned long long offset, unsigned long long length, char* out,
+                                        size_t out_cap, size_t* out_len)
+{
+    array_buf buf { out, out_cap };
+    std::ostream os { &buf };
+    const huffman_status status { decompress_range(in, in_len, offset, length, os) };
+    *out_len = buf.size();
+    return status == HUFFMAN_IO_ERROR ? HUFFMAN_OUTPUT_FULL : status;
+}
@@ -0,0 +1,64 @@
+#ifndef HUFFMAN_STREAM_H
+#define HUFFMAN_STREAM_H
+
+#include <cstddef>
+#include "block_coder.h"
+
+/*
+    Incremental coding in memory, for callers which get data by pieces and embed the codec in their process:
+
+        huffman_context* ctx { huffman_compressor(nullptr, 0) };
+        for every piece:    produced = compress_stream(ctx, piece, piece_size, out, out_capacity);
+        then:               produced = compress_end(ctx, out, out_capacity); until huffman_pending(ctx) is zero
+        huffman_free(ctx);
+
+    Input is always taken whole. Output which doesn't fit is kept by the context and handed out by the next calls,
+    which may pass no input for it. Blocks are coded once block_size bytes are gathered, the decompressor decodes
+    a block once all of it arrived, so either side holds about a block of data.
+    Files are those of the tool: the decompressor reads theirs and the tool reads the compressor's.
+
+    Data which are in memory whole are coded in one call, straight from the input to the caller's buffer:
+
+        std::vector<char> out(compress_bound(n, nullptr, 0));
+        huffman_compress(in, n, out.data(), out.size(), &out_len, nullptr, 0);
+        huffman_decompressed_size(out.data(), out_len, &size);
+        huffman_decompress(out.data(), out_len, raw, size, &raw_len, nullptr);
+        huffman_decompress_range(out.data(), out_len, offset, length, raw, length, &raw_len);
+*/
+
+enum huffman_status
+{
+    HUFFMAN_OK = 0,
+    HUFFMAN_FINISHED = 1,               // End block was written or read, the decompressor ignores input after it
+    HUFFMAN_CORRUPTED = -1,
+    HUFFMAN_CHECKSUM_MISMATCH = -2,
+    HUFFMAN_BAD_CALL = -3,              // Compressing with a decompressor or the other way round
+    HUFFMAN_NO_MEMORY = -4,
+    HUFFMAN_OUTPUT_FULL = -5,           // Output buffer of a one-call function is too small, see compress_bound
+    HUFFMAN_IO_ERROR = -6               // Stream of a file function in huffman_file.h couldn't be read, written or read again
+};
+
+struct huffman_context;
+
+huffman_context* huffman_compressor(const block_options* opt, unsigned block_size);    // Null options and zero size take defaults
+huffman_context* huffman_decompressor(const block_options* opt);                       // Null for invalid options
+void huffman_free(huffman_context* ctx);
+
+size_t compress_stream(huffman_context* ctx, const char* in, size_t in_len, char* out, size_t out_cap);    // Bytes put to `out`
+size_t compress_end(huffman_context* ctx, char* out, size_t out_cap);
+size_t decompress_stream(huffman_context* ctx, const char* in, size_t in_len, char* out, size_t out_cap);
+size_t huffman_pending(const huffman_context* ctx);     // Output bytes which didn't fit yet
+huffman_status huffman_get_status(const huffman_context* ctx);     // Calls after the end or an error only hand out pending output
+
+// Compressed size of `n` bytes never exceeds the bound, zero for invalid options
+size_t compress_bound(size_t n, const block_options* opt, unsigned block_size);
+// One-call functions return HUFFMAN_OK and set `out_len` to the bytes written, which is also done on errors
+huffman_status huffman_compress(const char* in, size_t in_len, char* out, size_t out_cap, size_t* out_len, const block_options* opt,
+                                unsigned block_size);
+huffman_status huffman_decompressed_size(const char* in, size_t in_len, unsigned long long* size);     // Sum of the block headers
+huffman_status huffman_decompress(const char* in, size_t in_len, char* out, size_t out_cap, size_t* out_len, const block_options* opt);
+// Bytes from `offset` on, at most `length` of them, found through the index at the end of the file; blocks outside are skipped
+huffman_status huffman_decompress_range(const char* in, size_t in_len, unsigned long long offset, unsigned long long length, char* out,
+                                        size_t out_cap, size_t* out_len);
+
+#endif // HUFFMAN_STREAM_H
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <sstream>
+#include "lz77.h"
+#include "block_format.h"
+#include "histogram.h"
+#include "bit_writer.h"
+#include "bit_reader.h"
+#include "mapped_file.h"
+
+namespace
+{
+    constexpr unsigned HASH_BITS { 17 };
+    constexpr uint32_t NO_POSITION { UINT32_MAX };
+    constexpr unsigned DIRECT_CODES { 16 };     // Runs and lengths below it are codes themselves
+    constexpr unsigned MAX_EXTRA_BITS { 31 };
+
+    struct level_params
+    {
+        unsigned chain_depth;
+        unsigned nice_length;
+    };
+
+    constexpr level_params LEVELS[LZ77_MAX_LEVEL + 1]
+    {
+        { 0, 0 }, { 4, 16 }, { 8, 24 }, { 16, 32 }, { 32, 48 }, { 64, 64 }, { 128, 96 }, { 256, 128 }, { 1024, 256 }, { 4096, 1024 }
+    };
+    constexpr unsigned LAZY_LEVEL { 4 };    // Lowest level with lazy matching
+
+    unsigned high_bit(uint32_t value)
+    {
+        unsigned res { };
+        while (value >>= 1)
+            ++res;
+        return res;
+    }
+
+    uint32_t hash(const char* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return (value * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    bool same_prefix(const char* a, const char* b)     // Rejects candidates which only share the hash
+    {
+        return memcmp(a, b, LZ77_MIN_MATCH) == 0;
+    }
+
+    uint32_t common_length(const char* a, const char* b, const char* end)
+    {   // Length of the common prefix of `a` and `b`, `a` precedes `b`
+        const char* start { b };
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        for (; b + sizeof(uint64_t) <= end; a += sizeof(uint64_t), b += sizeof(uint64_t))
+        {
+            uint64_t x, y;
+            memcpy(&x, a, sizeof(x));
+            memcpy(&y, b, sizeof(y));
+            if (x != y)
+                return static_cast<uint32_t>(b - start + __builtin_ctzll(x ^ y) / CHAR_DIGITS);
+        }
+#endif
+        for (; b < end && *a == *b; ++a, ++b) { }
+        return static_cast<uint32_t>(b - start);
+    }
+
+    unsigned char value_code(uint32_t value, bit_writer& extra)
+    {
+        if (value < DIRECT_CODES)
+            return static_cast<unsigned char>(value);
+        const unsigned bits { high_bit(value) };
+        extra.put(value - (1u << bits), bits);
+        return static_cast<unsigned char>(DIRECT_CODES - 4 + bits);
+    }
+
+    unsigned char distance_code(uint32_t distance, bit_writer& extra)
+    {
+        const unsigned bits { high_bit(distance) };
+        extra.put(distance - (1u << bits), bits);
+        return static_cast<unsigned char>(bits);
+    }
+
+    void write_stream(std::ostream& os, const std::vector<char>& symbols, unsigned max_code_length)
+    {   // Table, size of the stream and the stream, nothing for no symbols
+        if (symbols.empty())
+            return;
+        histogram counts { };
+        huffman_encoder encoder { };
+        counts.add(symbols.data(), symbols.size());
+        encoder.set_code_length_limit(max_code_length);
+        encoder.init_for_compressing();
+        encoder.add_counts(counts);
+        encoder.encode();
+        encoder.write_table(os);
+        std::vector<char> coded(encoder.payload_size() + BIT_WRITER_SLACK);
+        bit_writer writer { coded.data(), coded.size() };
+        encoder.encode_block(reinterpret_cast<const uint8_t*>(symbols.data()), symbols.size(), writer);
+        write_varint(os, writer.finish());
+        os.write(coded.data(), writer.size());
+    }
+
+    bool read_stream(std::istream& is, memory_buf& buf, std::vector<char>& symbols, size_t count)
+    {
+        symbols.resize(count);
+        if (count == 0)
+            return true;
+        huffman_encoder decoder { };
+        unsigned long long size;
+        if (!decoder.read_table(is) || !read_varint(is, size))
+            return false;
+        const char* data { buf.take(size) };
+        if (data == nullptr)
+            return false;
+        decoder.build_lookup();
+        decoder.init_for_decompressing(count);
+        decoder.decompress_block(data, size, symbols.data(), count);
+        return decoder.finished();
+    }
+
+    bool read_value(unsigned char code, bit_reader& extra, unsigned long long& value)
+    {
+        if (code < DIRECT_CODES)
+        {
+            value = code;
+            return true;
+        }
+        const unsigned bits { code - (DIRECT_CODES - 4) };
+        if (bits > MAX_EXTRA_BITS)
+            return false;
+        value = (1ull << bits) | extra.read(bits);
+        return true;
+    }
+}
+
+lz77_parser::lz77_parser(unsigned level, size_t window_size)
+: chain_depth { LEVELS[std::min(std::max(level, 1u), LZ77_MAX_LEVEL)].chain_depth },
+  nice_length { LEVELS[std::min(std::max(level, 1u), LZ77_MAX_LEVEL)].nice_length },
+  lazy { level >= LAZY_LEVEL },
+  window { 1 },
+  head(1u << HASH_BITS)
+{   // Window is rounded up to a power of two, so positions wrap around `prev` by a mask
+    while (window < window_size && window < (1u << MAX_EXTRA_BITS))
+        window <<= 1;
+    prev.resize(window);
+}
+
+lz77_parser::match lz77_parser::find(const char* data, size_t n, uint32_t pos) const
+{   // Positions before `pos` in the window are in the chains, so no link points to a newer position
+    match best { 0, 0 };
+    uint32_t candidate { head[hash(data + pos)] };
+    for (unsigned depth = 0; depth < chain_depth && candidate != NO_POSITION && pos - candidate <= window; ++depth)
+    {
+        if (best.length == n - pos)
+            break;
+        if (data[candidate + best.length] == data[pos + best.length] && same_prefix(data + candidate, data + pos))
+        {
+            const uint32_t length { common_length(data + candidate, data + pos, data + n) };
+            if (length > best.length)
+            {
+                best = { length, pos - candidate };
+                if (length >= nice_length)
+                    break;
+            }
+        }
+        candidate = prev[candidate & (window - 1)];
+    }
+    return best;
+}
+
+void lz77_parser::insert(const char* data, uint32_t pos)
+{
+    uint32_t& first { head[hash(data + pos)] };
+    prev[pos & (window - 1)] = first;
+    first = pos;
+}
+
+void lz77_parser::parse(const char* data, size_t n, std::vector<lz77_sequence>& sequences, std::vector<char>& literals)
+{   // Every position is inserted once, also the ones inside of matches
+    uint32_t anchor { }, next_insert { };
+    std::fill(head.begin(), head.end(), NO_POSITION);
+    for (uint32_t i = 0; i + LZ77_MIN_MATCH <= n;)
+    {
+        for (; next_insert < i; ++next_insert)
+            insert(data, next_insert);
+        match m { find(data, n, i) };
+        insert(data, i);
+        next_insert = i + 1;
+        if (m.length < LZ77_MIN_MATCH)
+        {
+            ++i;
+            continue;
+        }
+        while (lazy && m.length < nice_length && i + 1 + LZ77_MIN_MATCH <= n)
+        {
+            const match next { find(data, n, i + 1) };
+            insert(data, i + 1);
+            next_insert = i + 2;
+            if (next.length <= m.length)
+                break;
+            ++i;
+            m = next;
+        }
+        sequences.push_back({ i - anchor, m.length, m.distance });
+        literals.insert(literals.end(), data + anchor, data + i);
+        i += m.length;
+        anchor = i;
+    }
+    literals.insert(literals.end(), data + anchor, data + n);
+}
+
+std::vector<char> lz77_encode(const char* data, size_t n, unsigned level, size_t window, unsigned max_code_length)
+{   // Codes of every kind make their own stream, so each one is decoded by the table-driven decoder at once
+    lz77_parser parser { level, std::min(window, n) };    // Matches never reach past the start of the block
+    std::vector<lz77_sequence> sequences;
+    std::vector<char> literals;
+    parser.parse(data, n, sequences, literals);
+
+    std::vector<char> runs, lengths, distances;
+    std::vector<char> extra(sequences.size() * 3 * sizeof(uint32_t) + BIT_WRITER_SLACK);
+    bit_writer writer { extra.data(), extra.size() };
+    for (const lz77_sequence& s : sequences)
+    {
+        runs.push_back(static_cast<char>(value_code(s.literals, writer)));
+        lengths.push_back(static_cast<char>(value_code(s.length - LZ77_MIN_MATCH, writer)));
+        distances.push_back(static_cast<char>(distance_code(s.distance, writer)));
+    }
+    extra.resize(writer.finish());
+
+    std::ostringstream out;
+    write_varint(out, sequences.size());
+    write_varint(out, literals.size());
+    write_stream(out, literals, max_code_length);
+    write_stream(out, runs, max_code_length);
+    write_stream(out, lengths, max_code_length);
+    write_stream(out, distances, max_code_length);
+    out.write(extra.data(), extra.size());
+    const std::string res { out.str() };
+    return std::vector<char>(res.begin(), res.end());
+}
+
+bool lz77_decode(const char* payload, size_t size, char* out, size_t raw_size)
+{   // Streams of codes are decoded first, then sequences are replayed with the extra bits
+    memory_buf buf { };
+    std::istream is { &buf };
+    unsigned long long count, literal_count;
+    std::vector<char> literals, runs, lengths, distances;
+
+    buf.reset(const_cast<char*>(payload), size);
+    if (!read_varint(is, count) || !read_varint(is, literal_count) || literal_count > raw_size || count > raw_size / LZ77_MIN_MATCH)
+        return false;
+    if (!read_stream(is, buf, literals, literal_count) || !read_stream(is, buf, runs, count)
+        || !read_stream(is, buf, lengths, count) || !read_stream(is, buf, distances, count))
+        return false;
+    const size_t extra_size { static_cast<size_t>(is.rdbuf()->in_avail()) };
+    bit_reader extra { buf.take(extra_size), extra_size };
+
+    size_t pos { }, literal { };
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned long long run, length;
+        const unsigned distance_bits { static_cast<unsigned char>(distances[i]) };
+        if (!read_value(static_cast<unsigned char>(runs[i]), extra, run) || !read_value(static_cast<unsigned char>(lengths[i]), extra, length)
+            || distance_bits > MAX_EXTRA_BITS)
+            return false;
+        const unsigned long long distance { (1ull << distance_bits) | extra.read(distance_bits) };
+        length += LZ77_MIN_MATCH;
+        if (run > literals.size() - literal || run > raw_size - pos)
+            return false;
+        std::copy(literals.begin() + literal, literals.begin() + literal + run, out + pos);
+        pos += run;
+        literal += run;
+        if (distance > pos || length > raw_size - pos)
+            return false;
+        char* dst { out + pos };
+        const char* src { dst - distance };
+        if (distance >= length)
+            memcpy(dst, src, length);
+        else
+            for (size_t k = 0; k < length; ++k) { dst[k] = src[k]; }     // Overlapping copy repeats the last `distance` bytes
+        pos += length;
+    }
+    if (literals.size() - literal != raw_size - pos)
+        return false;
+    std::copy(literals.begin() + literal, literals.end(), out + pos);
+    return (extra.position + CHAR_DIGITS - 1) / CHAR_DIGITS == extra_size;
+}
@@ -0,0 +1,57 @@
+#ifndef LZ77_H
+#define LZ77_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "huffman_encoder.h"
+
+constexpr unsigned LZ77_MIN_MATCH { 4 };        // Shorter repeats are left to the literal coder
+constexpr unsigned LZ77_MAX_LEVEL { 9 };
+constexpr unsigned LZ77_DEFAULT_WINDOW { 256 * 1024 };
+
+/*
+    Payload of an LZ77 block:  number of sequences, number of literals, then literals, literal run codes,
+                               match length codes and distance codes, each one as a Huffman table, a varint size
+                               and a stream, absent when it has no symbols; extra bits of the codes fill the rest
+    Sequence:                  run of literals followed by a match, literals after the last match close the block
+    Run and length codes:      values below 16 are codes themselves, larger ones are 12 + their highest bit
+                               followed by the bits below it; lengths are stored less LZ77_MIN_MATCH
+    Distance codes:            the highest bit of the distance followed by the bits below it
+*/
+
+struct lz77_sequence
+{
+    uint32_t literals;      // Literals before the match
+    uint32_t length;
+    uint32_t distance;
+};
+
+struct lz77_parser  // Greedy or lazy parsing over hash chains, positions are local to a block
+{
+    lz77_parser(unsigned level, size_t window_size);
+
+    void parse(const char* data, size_t n, std::vector<lz77_sequence>& sequences, std::vector<char>& literals);
+
+private:
+    struct match
+    {
+        uint32_t length;
+        uint32_t distance;
+    };
+
+    match find(const char* data, size_t n, uint32_t pos) const;
+    void insert(const char* data, uint32_t pos);
+
+    unsigned chain_depth;   // Candidates tried at every position
+    unsigned nice_length;   // Matches at least this long end the search
+    bool lazy;              // Match is deferred if the next position has a longer one
+    uint32_t window;
+    std::vector<uint32_t> head;     // Last position of every hash
+    std::vector<uint32_t> prev;     // Previous position with the same hash, indexed modulo the window
+};
+
+std::vector<char> lz77_encode(const char* data, size_t n, unsigned level, size_t window, unsigned max_code_length);
+bool lz77_decode(const char* payload, size_t size, char* out, size_t raw_size);     // False for corrupted data
+
+#endif // LZ77_H
@@ -0,0 +1,101 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <streambuf>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct mapped_file  // Regular file mapped into memory, anything else is left to streams
+{
+    mapped_file() { };
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file() { close(); }
+
+    bool map_input(const char* path)
+    {
+        close();
+        fd = ::open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            close();
+            return false;
+        }
+        length = st.st_size;
+        if (length == 0)    // Empty files can't be mapped, but there is nothing to read anyway
+            return true;
+        void* p { mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) };
+        if (p == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        madvise(p, length, MADV_SEQUENTIAL);
+        addr = static_cast<char*>(p);
+        return true;
+    }
+
+    bool map_output(const char* path, size_t size)
+    {   // Space is allocated up front, so a full disk is reported here instead of by a signal on write
+        close();
+        fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || size == 0 || posix_fallocate(fd, 0, size) != 0)
+        {
+            close();
+            return false;
+        }
+        void* p { mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) };
+        if (p == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        length = size;
+        addr = static_cast<char*>(p);
+        return true;
+    }
+
+    void close()
+    {
+        if (addr != nullptr)
+            munmap(addr, length);
+        if (fd >= 0)
+            ::close(fd);
+        addr = nullptr;
+        length = 0;
+        fd = -1;
+    }
+
+    char* data() const { return addr; }
+    size_t size() const { return length; }
+
+private:
+    char* addr { nullptr };
+    size_t length { 0 };
+    int fd { -1 };
+};
+
+struct memory_buf : std::streambuf  // Lets a stream parse mapped data and hands out pointers into it
+{
+    void reset(char* data, size_t size) { setg(data, data, data + size); }
+
+    size_t consumed() const { return gptr() - eback(); }    // Bytes read or taken since the reset
+
+    const char* take(size_t n)  // Null if fewer than `n` bytes are left
+    {
+        if (static_cast<size_t>(egptr() - gptr()) < n)
+            return nullptr;
+        const char* res { gptr() };
+        setg(eback(), gptr() + n, egptr());
+        return res;
+    }
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,170 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Stages of reading, coding and writing run on threads of their own and hand data over through bounded queues,
+// so a slow stage holds up the others only once its queue fills
+
+template <typename T>
+struct bounded_queue    // Hands items from one thread to another, the producer waits while the queue is full
+{
+    explicit bounded_queue(size_t capacity)
+    : capacity { capacity } { };
+
+    bounded_queue(const bounded_queue&) = delete;
+    bounded_queue& operator=(const bounded_queue&) = delete;
+
+    bool push(T item)   // False if the queue was closed, the item is dropped then
+    {
+        std::unique_lock<std::mutex> lock { m };
+        not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+        items.push_back(std::move(item));
+        lock.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item)   // False once the queue is closed and empty
+    {
+        std::unique_lock<std::mutex> lock { m };
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close()        // Items already queued can still be popped
+    {
+        {
+            std::lock_guard<std::mutex> lock { m };
+            closed = true;
+        }
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::deque<T> items { };
+    std::mutex m { };
+    std::condition_variable not_full { };
+    std::condition_variable not_empty { };
+    bool closed { false };
+};
+
+template <typename T>
+struct read_ahead   // Reads items on a thread of its own until `read` returns false
+{
+    read_ahead(size_t capacity, std::function<bool(T&)> read)
+    : items { capacity }, thread { [this, read] { run(read); } } { };
+
+    read_ahead(const read_ahead&) = delete;
+    read_ahead& operator=(const read_ahead&) = delete;
+
+    ~read_ahead()
+    {   // Reader stops at its next push, though a read in progress is finished first
+        items.close();
+        thread.join();
+    }
+
+    bool pop(T& item)   // False after the last item, rethrows the failure of the reader
+    {
+        if (items.pop(item))
+            return true;
+        if (failure)
+            std::rethrow_exception(failure);
+        return false;
+    }
+
+private:
+    void run(const std::function<bool(T&)>& read)
+    {
+        try
+        {
+            for (T item; read(item) && items.push(std::move(item));) { }
+        }
+        catch (...)
+        {
+            failure = std::current_exception();
+        }
+        items.close();
+    }
+
+    bounded_queue<T> items;
+    std::exception_ptr failure { };     // Set before the queue is closed
+    std::thread thread;
+};
+
+struct ordered_writer   // Runs writes on a thread of its own in the order they were queued
+{
+    explicit ordered_writer(size_t capacity)
+    : jobs { capacity }, thread { [this] { run(); } } { };
+
+    ordered_writer(const ordered_writer&) = delete;
+    ordered_writer& operator=(const ordered_writer&) = delete;
+
+    ~ordered_writer()
+    {   // Writes queued before an exception are still done, so the output keeps everything before the failure
+        jobs.close();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    bool push(std::function<void()> job)    // False if an earlier write failed, finish() rethrows the failure
+    {
+        return jobs.push(std::move(job));
+    }
+
+    template <typename T, typename F>
+    bool push(std::future<T> result, F write)   // `write` gets the result once it is ready
+    {
+        auto ready = std::make_shared<std::future<T>>(std::move(result));
+        return push([ready, write] { write(ready->get()); });
+    }
+
+    void finish()       // Waits for the queued writes, rethrows the first failure
+    {
+        jobs.close();
+        if (thread.joinable())
+            thread.join();
+        if (failure)
+            std::rethrow_exception(failure);
+    }
+
+private:
+    void run()
+    {
+        std::function<void()> job;
+        try
+        {
+            while (jobs.pop(job))
+                job();
+        }
+        catch (...)
+        {
+            failure = std::current_exception();
+            jobs.close();
+        }
+    }
+
+    bounded_queue<std::function<void()>> jobs;
+    std::exception_ptr failure { };
+    std::thread thread;
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include "tans_encoder.h"
+#include "histogram.h"
+#include "block_format.h"
+#include "bit_reader.h"
+#include "bit_writer.h"
+
+namespace
+{
+    unsigned high_bit(unsigned value)   // Position of the highest set bit
+    {
+        unsigned res { };
+        while (value >>= 1)
+            ++res;
+        return res;
+    }
+
+    struct backward_writer  // Bits put later end up earlier in the stream, which is written from its end
+    {
+        backward_writer(char* begin, char* end)
+        : begin { begin }, pos { end } { };
+
+        void put(uint32_t value, unsigned length)    // Length mustn't exceed 32 bits
+        {   // Stores the whole accumulator before the position as bit_writer does after it
+            acc |= static_cast<uint64_t>(value) << count;
+            count += length;
+            if (pos - begin >= static_cast<ptrdiff_t>(sizeof(uint64_t)))
+            {
+                store_big_endian(pos - sizeof(uint64_t), acc);
+                pos -= count / 8;
+                acc >>= count & ~7u;
+                count %= 8;
+                return;
+            }
+            for (; count >= 8; count -= 8)
+            {
+                *--pos = static_cast<char>(acc);
+                acc >>= 8;
+            }
+        }
+
+        char* finish()      // Pads the first byte with zeroes, returns the start of the stream
+        {
+            for (; count > 0; count -= std::min(count, 8u))
+            {
+                *--pos = static_cast<char>(acc);
+                acc >>= 8;
+            }
+            return pos;
+        }
+
+    private:
+        char* begin;
+        char* pos;
+        uint64_t acc { };
+        unsigned count { };     // Pending bits in the lowest bits of `acc`
+    };
+}
+
+void tans_encoder::build(const histogram& h)
+{   // Counts are scaled down, then single states are moved where they change the coded size most
+    const unsigned size { 1u << TANS_TABLE_LOG };
+    unsigned sum { };
+
+    table_log = TANS_TABLE_LOG;
+    std::copy(h.counts, h.counts + CHAR_RANGE, counts);
+    for (unsigned s = 0; s < CHAR_RANGE; ++s)
+    {
+        normalized[s] = counts[s] > 0 ? std::max(1u, static_cast<unsigned>(counts[s] * size / h.total)) : 0;
+        sum += normalized[s];
+    }
+    for (; sum < size; ++sum)
+    {
+        unsigned best { };
+        double gain { -1 };
+        for (unsigned s = 0; s < CHAR_RANGE; ++s)
+        {
+            const double g { counts[s] > 0 ? counts[s] * std::log2((normalized[s] + 1.0) / normalized[s]) : -1 };
+            if (g > gain)
+            {
+                gain = g;
+                best = s;
+            }
+        }
+        ++normalized[best];
+    }
+    for (; sum > size; --sum)
+    {   // Symbols which got a state only for being present push the others down
+        unsigned best { };
+        double loss { -1 };
+        for (unsigned s = 0; s < CHAR_RANGE; ++s)
+        {
+            const double l { normalized[s] > 1 ? counts[s] * std::log2(normalized[s] / (normalized[s] - 1.0)) : -1 };
+            if (l >= 0 && (loss < 0 || l < loss))
+            {
+                loss = l;
+                best = s;
+            }
+        }
+        --normalized[best];
+    }
+    build_tables();
+}
+
+void tans_encoder::build_tables()
+{   // Symbols are spread over states with an odd step, so they visit every state once
+    const unsigned size { 1u << table_log };
+    const unsigned step { (size >> 1) + (size >> 3) + 3 };
+    std::vector<unsigned char> spread(size);
+    unsigned next[CHAR_RANGE];
+
+    for (unsigned s = 0, pos = 0, cumulative = 0; s < CHAR_RANGE; ++s)
+    {
+        for (unsigned i = 0; i < normalized[s]; ++i, pos = (pos + step) & (size - 1))
+            spread[pos] = static_cast<unsigned char>(s);
+        if (normalized[s] > 0)
+        {
+            const unsigned max_bits { table_log - high_bit(normalized[s]) };
+            transforms[s] = { normalized[s] << max_bits, max_bits, cumulative };
+        }
+        next[s] = normalized[s];
+        cumulative += normalized[s];
+    }
+
+    states.resize(size);
+    decode.resize(size);
+    for (unsigned x = 0; x < size; ++x)
+    {   // Occurrences of a symbol are numbered from its count up to twice the count
+        const unsigned char s { spread[x] };
+        const unsigned y { next[s]++ };
+        const unsigned bits { table_log - high_bit(y) };
+        states[transforms[s].cumulative + y - normalized[s]] = static_cast<uint16_t>(size + x);
+        decode[x] = { static_cast<uint16_t>((y << bits) - size), s, static_cast<unsigned char>(bits) };
+    }
+}
+
+bool tans_encoder::read_table(std::istream& is)
+{
+    unsigned char log { };
+    unsigned long long sum { };
+
+    is.read(reinterpret_cast<char*>(&log), sizeof(char));
+    if (log == 0 || log > TANS_MAX_TABLE_LOG)
+        return false;
+    for (unsigned s = 0; s < CHAR_RANGE && is;)
+    {
+        unsigned long long count;
+        if (!read_varint(is, count) || count > (1u << log))
+            return false;
+        if (count > 0)
+        {
+            normalized[s++] = static_cast<unsigned>(count);
+            sum += count;
+            continue;
+        }
+        unsigned char run { };    // Run of absent symbols, decremented by one
+        is.read(reinterpret_cast<char*>(&run), sizeof(char));
+        if (s + run >= CHAR_RANGE)
+            return false;
+        std::fill(normalized + s, normalized + s + run + 1, 0);
+        s += run + 1;
+    }
+    if (!is || sum != (1u << log))
+        return false;
+    table_log = log;
+    std::fill(counts, counts + CHAR_RANGE, 0);
+    build_tables();
+    return true;
+}
+
+void tans_encoder::write_table(std::ostream& os) const
+{
+    os.put(static_cast<char>(table_log));
+    for (unsigned s = 0; s < CHAR_RANGE;)
+    {
+        if (normalized[s] > 0)
+        {
+            write_varint(os, normalized[s++]);
+            continue;
+        }
+        unsigned char run { };
+        while (s + run + 1 < CHAR_RANGE && normalized[s + run + 1] == 0 && run < UCHAR_MAX)
+            ++run;
+        os.put(0);
+        os.put(static_cast<char>(run));
+        s += run + 1;
+    }
+}
+
+tans_encoder::ull tans_encoder::estimated_size() const
+{
+    double bits { table_log + 1.0 };    // Final state and the start marker
+    for (unsigned s = 0; s < CHAR_RANGE; ++s)
+    {
+        if (counts[s] > 0)
+            bits += counts[s] * (table_log - std::log2(normalized[s]));
+    }
+    return static_cast<ull>(std::ceil(bits / CHAR_DIGITS));
+}
+
+size_t tans_encoder::max_payload_size(size_t n)
+{
+    return (static_cast<unsigned long long>(n + 1) * TANS_MAX_TABLE_LOG + 1 + CHAR_DIGITS - 1) / CHAR_DIGITS;
+}
+
+size_t tans_encoder::encode_block(const uint8_t* in, size_t n, char* out) const
+{   // Symbols are coded from the last one, so that the decoder reads the stream forward
+    const unsigned size { 1u << table_log };
+    char* end { out + max_payload_size(n) };
+    backward_writer writer { out, end };
+    uint32_t state { size };
+
+    for (size_t i = n; i-- > 0;)
+    {
+        const symbol_transform& t { transforms[in[i]] };
+        const unsigned bits { t.max_bits - (state < t.threshold) };
+        writer.put(state & ((1u << bits) - 1), bits);
+        state = states[t.cumulative + (state >> bits) - normalized[in[i]]];
+    }
+    writer.put(state - size, table_log);
+    writer.put(1, 1);   // Marks the end of the padding
+    const char* begin { writer.finish() };
+    memmove(out, begin, end - begin);
+    return end - begin;
+}
+
+void tans_encoder::init_for_decompressing(const char* data, size_t n)
+{
+    if (n == 0 || data[0] == 0)
+        throw std::runtime_error { "Stream has no start marker" };
+    reader = { data, n };
+    reader.position = CHAR_DIGITS - high_bit(static_cast<unsigned char>(data[0]));
+    state = reader.read(table_log);
+}
+
+void tans_encoder::decompress_block(char* out, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        const decode_entry& e { decode[state] };
+        out[i] = static_cast<char>(e.symbol);
+        state = e.base + reader.read(e.bits);
+    }
+}
+
+bool tans_encoder::finished() const
+{   // Coder starts from the lowest state, so the decoder must end in it having read everything
+    return state == 0 && reader.position == reader.size() * CHAR_DIGITS;
+}
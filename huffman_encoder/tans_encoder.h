@@ -0,0 +1,58 @@
+#ifndef TANS_ENCODER_H
+#define TANS_ENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "huffman_encoder.h"
+#include "bit_reader.h"
+
+struct histogram;
+
+constexpr unsigned TANS_TABLE_LOG { 11 };       // States of the coder, normalized counts sum to 2^TANS_TABLE_LOG
+constexpr unsigned TANS_MAX_TABLE_LOG { 12 };   // Largest table accepted by the decoder
+
+struct tans_encoder     // Table-based asymmetric numeral systems, fractional bits per symbol unlike Huffman codes
+{
+    typedef unsigned long long ull;
+
+    void build(const histogram& h);
+    bool read_table(std::istream& is);
+    void write_table(std::ostream& os) const;
+    ull estimated_size() const;                     // Payload size by the entropy of normalized counts, in bytes
+    static size_t max_payload_size(size_t n);
+    size_t encode_block(const uint8_t* in, size_t n, char* out) const;     // `out` must fit max_payload_size(n) bytes
+    void init_for_decompressing(const char* data, size_t n);     // Payload must outlive the decoding
+    void decompress_block(char* out, size_t size);                  // Decodes next `size` symbols
+    bool finished() const;
+    bool exhausted() const { return reader.position > reader.size() * CHAR_DIGITS; }  // Read past the payload
+
+private:
+    struct symbol_transform
+    {
+        uint32_t threshold;     // States below it output one bit less
+        unsigned max_bits;
+        unsigned cumulative;    // Position of the first state of the symbol in `states`
+    };
+    struct decode_entry
+    {
+        uint16_t base;          // Next state without the bits read
+        unsigned char symbol;
+        unsigned char bits;
+    };
+
+    void build_tables();
+
+    unsigned table_log { TANS_TABLE_LOG };
+    unsigned normalized[CHAR_RANGE] { };    // Indexed by unsigned char
+    ull counts[CHAR_RANGE] { };             // Counts the table was built from, empty after read_table
+    symbol_transform transforms[CHAR_RANGE] { };
+    std::vector<uint16_t> states { };       // Encoder states, grouped by symbol
+    std::vector<decode_entry> decode { };
+    bit_reader reader { nullptr, 0 };
+    unsigned state { };                     // Decoder state, the lowest one is added by the coder
+};
+
+#endif // TANS_ENCODER_H
@@ -1,12 +1,15 @@
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <chrono>
 #include <memory>
 #include <fstream>
 #include <iostream>
-#include <cstring>
 #include <vector>
-#include "huffman_encoder.h"
+#include "mapped_file.h"
+#include "huffman_stream.h"
+#include "huffman_file.h"
+#include "dictionary.h"
 
 #ifndef COLOR_SUPPORT
 #define COLOR_SUPPORT 1
@@ -16,207 +19,412 @@ using namespace std;
 
 const char* DEFAULT_FILE = "dst.huf";
 
-std::ifstream is { };
-std::ofstream os { };
-char read_buffer[BUFFER_SIZE];
-char write_buffer[BUFFER_SIZE] { };
-unsigned buffer_length;
-unsigned buffer_counter;
-
-void init_streams(const char* src, const char* dst)
-{
-    is = std::ifstream(src, std::ios_base::binary);
-    os = std::ofstream(dst, std::ios_base::binary);
-
-    if (!is.is_open()) throw std::runtime_error { "Couldn't open the source file" };
-    if (!os.is_open()) throw std::runtime_error { "Couldn't open the destination file" };
-}
+const char* STANDARD_STREAM = "-";
 
-bool is_file_empty()
+struct options : file_options     // Coding of files is left to the library, the rest is how the tool runs it
 {
-    return (is.peek() == std::ifstream::traits_type::eof());
-}
-
-void bad_file()
+    bool stream { false };          // Single pass over the input, one table per block
+    unsigned long long offset { 0 };        // Range of decompressed data, the whole file by default
+    unsigned long long length { ULLONG_MAX };
+    unsigned piece_size { 0 };      // Nonzero goes through the incremental API of the library by pieces of this size
+    const char* dictionary { nullptr };     // Codes the source as one message against this dictionary, with no header
+    bool memory { false };          // Codes the whole source with one call of the library, from memory to memory
+};
+
+struct tool_files   // Source and destination of one run
 {
-    std::cout << "Error while decoding file, perhaps the file is corrupted\n";
-    exit(0);
-}
+    void open_input(const char* src, bool map)
+    {   // "-" stands for standard input, other regular files are mapped if asked to
+        if (strcmp(src, STANDARD_STREAM) == 0)
+            is.rdbuf(std::cin.rdbuf());
+        else if (map && input_map.map_input(src))
+        {
+            mapped_input.reset(input_map.data(), input_map.size());
+            is.rdbuf(&mapped_input);
+        }
+        else if (in_file.open(src, std::ios_base::in | std::ios_base::binary))
+            is.rdbuf(&in_file);
+        else
+            throw std::runtime_error { "Couldn't open the source file" };
+    }
 
-void read_block(int size = BUFFER_SIZE)
-{
-    is.read(read_buffer, size);
-}
+    void open_output(const char* dst)
+    {   // "-" stands for standard output
+        if (strcmp(dst, STANDARD_STREAM) == 0)
+            os.rdbuf(std::cout.rdbuf());
+        else if (out_file.open(dst, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary))
+            os.rdbuf(&out_file);
+        else
+            throw std::runtime_error { "Couldn't open the destination file" };
+    }
 
-void process_file(std::function<void(char)> func, std::ios_base::seekdir it = is.beg)
-{
-    is.seekg(0, it);
-    auto pos = is.tellg();
-    is.seekg(0, is.end);
-    long long remainder { is.tellg() };
-    is.seekg(pos);
-    remainder -= is.tellg();
-
-    while (remainder > BUFFER_SIZE)
+    bool input_mapped() const
     {
-        read_block();
-        for (auto& c : read_buffer) { func(c); }
-        remainder -= BUFFER_SIZE;
+        return is.rdbuf() == &mapped_input;
     }
 
-    read_block(remainder);
+    std::filebuf in_file { };
+    std::filebuf out_file { };
+    std::istream is { nullptr };
+    std::ostream os { nullptr };
+    mapped_file input_map { };
+    memory_buf mapped_input { };
+};
 
-    for (int i = 0; i < remainder; ++i) { func(read_buffer[i]); }
-    is.clear();
-}
-
-void write_block(int size = BUFFER_SIZE)
+enum status_code    // Exit status of the program
 {
-    os.write(write_buffer, size);
+    STATUS_OK = 0,
+    STATUS_BAD_USAGE = 1,
+    STATUS_IO_ERROR = 2,            // Files couldn't be opened, read or written
+    STATUS_CORRUPTED = 3,           // Compressed data can't be decoded
+    STATUS_CHECKSUM_MISMATCH = 4    // Data were decoded, but they aren't the ones which were compressed
+};
+
+const char* status_message(status_code code)
+{
+    switch (code)
+    {
+    case STATUS_OK: return "Done";
+    case STATUS_BAD_USAGE: return "Bad usage";
+    case STATUS_IO_ERROR: return "Error while reading or writing a file";
+    case STATUS_CORRUPTED: return "Error while decoding file, perhaps the file is corrupted";
+    case STATUS_CHECKSUM_MISMATCH: return "Error while decoding file, checksum doesn't match";
+    }
+    return "Unknown error";
 }
 
-void check_buffer()
+status_code to_status(huffman_status status)
 {
-    if (buffer_length == MAX_BUFFER_LENGTH)
+    switch (status)
     {
-        buffer_length = 0;
-        write_block();
-        memset(write_buffer, 0, sizeof(char) * BUFFER_SIZE);    // XOR can mess with dirty bits
+    case HUFFMAN_OK: case HUFFMAN_FINISHED: return STATUS_OK;
+    case HUFFMAN_BAD_CALL: return STATUS_BAD_USAGE;
+    case HUFFMAN_IO_ERROR: return STATUS_IO_ERROR;
+    case HUFFMAN_CHECKSUM_MISMATCH: return STATUS_CHECKSUM_MISMATCH;
+    default: return STATUS_CORRUPTED;
     }
 }
 
-void write_to_buffer(const huffman_encoder::code& c)
+status_code compress(const char* src, const char* dst, const options& opt)
 {
-    const unsigned offset { buffer_length % CHAR_DIGITS };
-    const unsigned roffset { CHAR_DIGITS - offset };
+    tool_files files { };
+    files.open_input(src, !opt.stream);
+    if (opt.shared_table && !files.input_mapped()
+        && files.is.rdbuf()->pubseekoff(0, std::ios_base::cur, std::ios_base::in) == std::streampos(-1))
+        throw std::runtime_error { "Shared table needs a source which can be read twice, not a pipe" };    // Before the output is created
+    files.open_output(dst);
+
+    mapped_file output { };
+    auto reserve = [dst, &output](unsigned long long size) -> char*
+    {   // Regular files are mapped at their final size, standard output, devices and pipes are written by pieces
+        return strcmp(dst, STANDARD_STREAM) != 0 && output.map_output(dst, size) ? output.data() : nullptr;
+    };
+    const huffman_status status { files.input_mapped() ? compress_whole(files.input_map.data(), files.input_map.size(), files.os, opt, reserve)
+                                                       : compress_file(files.is, files.os, opt) };
+    if (!files.os.flush())
+        return STATUS_IO_ERROR;
+    return to_status(status);
+}
 
-    for (unsigned i = 0; i < c.digits.size() - 1; ++i)
+status_code decompress(const char* src, const char* dst, const options& opt)
+{   // Decoding stops at the first error, data decoded before it are kept in the output
+    tool_files files { };
+    files.open_input(src, true);
+    files.open_output(dst);
+    huffman_status status;
+    if (opt.offset > 0 || opt.length != ULLONG_MAX)
+    {   // Range is found through the index at the end of the file
+        if (!files.input_mapped())
+            return STATUS_IO_ERROR;
+        status = decompress_range(files.input_map.data(), files.input_map.size(), opt.offset, opt.length, files.os);
+    }
+    else
     {
-        write_buffer[buffer_length / CHAR_DIGITS] ^= static_cast<unsigned char>(c[i]) >> offset;
-        buffer_length += roffset;
-        check_buffer();
-        write_buffer[buffer_length / CHAR_DIGITS] ^= static_cast<unsigned char>(c[i]) << roffset;
-        buffer_length += offset;
-        check_buffer();
+        status = decompress_file(files.is, files.os, opt);
     }
-    unsigned char left { static_cast<unsigned char>(c.size - (c.digits.size() - 1) * CHAR_DIGITS) };
+    files.os.flush();
+    if (status != HUFFMAN_OK)
+        return to_status(status);
+    return files.os ? STATUS_OK : STATUS_IO_ERROR;
+}
 
-    write_buffer[buffer_length / CHAR_DIGITS] ^= static_cast<unsigned char>(c.digits.back()) >> offset;
-    if (left <= roffset)
+status_code code_by_pieces(bool compressing, const char* src, const char* dst, const options& opt)
+{   // Input and output buffers are as small as the pieces, so the context keeps the output which doesn't fit
+    tool_files files { };
+    files.open_input(src, false);
+    files.open_output(dst);
+    huffman_context* ctx { compressing ? huffman_compressor(&opt, opt.block_size) : huffman_decompressor(&opt) };
+    std::vector<char> in(opt.piece_size), out(opt.piece_size);
+    unsigned long long total { };
+    auto write_out = [&](size_t produced)
     {
-        buffer_length += left;
-        check_buffer();
-        return;
-    }
-    buffer_length += roffset;
-    check_buffer();
-    write_buffer[buffer_length / CHAR_DIGITS] ^= static_cast<unsigned char>(c.digits.back()) << roffset;
-    buffer_length += left - roffset;
-    check_buffer();
-}
+        files.os.write(out.data(), produced);
+        while (huffman_pending(ctx) > 0)
+        {
+            files.os.write(out.data(), compressing ? compress_stream(ctx, nullptr, 0, out.data(), out.size())
+                                                   : decompress_stream(ctx, nullptr, 0, out.data(), out.size()));
+        }
+    };
 
-void write_char_to_buffer(char c)   // Don't use it with write_to_buffer
-{
-    write_buffer[buffer_counter] = c;
-    if (++buffer_counter == BUFFER_SIZE)
+    if (ctx == nullptr)
+        return STATUS_BAD_USAGE;
+    while (files.is.read(in.data(), in.size()) || files.is.gcount() > 0)
     {
-        buffer_counter = 0;
-        write_block();
+        const size_t n { static_cast<size_t>(files.is.gcount()) };
+        total += n;
+        write_out(compressing ? compress_stream(ctx, in.data(), n, out.data(), out.size())
+                              : decompress_stream(ctx, in.data(), n, out.data(), out.size()));
     }
+    if (compressing)
+        write_out(compress_end(ctx, out.data(), out.size()));
+    const huffman_status status { huffman_get_status(ctx) };
+    huffman_free(ctx);
+    if (!files.os.flush())
+        return STATUS_IO_ERROR;
+    if (status == HUFFMAN_FINISHED || (status == HUFFMAN_OK && total == 0))    // Empty files have no blocks
+        return STATUS_OK;
+    return status == HUFFMAN_CHECKSUM_MISMATCH ? STATUS_CHECKSUM_MISMATCH : STATUS_CORRUPTED;
 }
 
-void flush_buffer()
-{
-    write_block(buffer_length / CHAR_DIGITS + ((buffer_length % CHAR_DIGITS) > 0));
-}
 
-void flush_buffer_to_counter()
-{
-    write_block(buffer_counter);
+status_code code_message(bool compressing, const char* src, const char* dst, const options& opt)
+{   // Output is the message alone, nothing tells it was coded with a dictionary
+    std::ifstream dictionary_file { opt.dictionary, std::ios_base::in | std::ios_base::binary };
+    if (!dictionary_file)
+        throw std::runtime_error { "Couldn't open the dictionary" };
+    const std::shared_ptr<huffman_dictionary> dict { read_dictionary(dictionary_file) };
+    if (!dict)
+        return STATUS_CORRUPTED;
+    tool_files files { };
+    files.open_input(src, false);
+    files.open_output(dst);
+
+    const std::shared_ptr<std::vector<char>> data { read_chunk(files.is, ULLONG_MAX) };
+    std::vector<char> res;
+    try
+    {
+        res = compressing ? dictionary_compress(*dict, data->data(), data->size()) : dictionary_decompress(*dict, data->data(), data->size());
+    }
+    catch (const std::runtime_error&)
+    {
+        return STATUS_CORRUPTED;
+    }
+    if (files.is.bad() || !files.os.write(res.data(), res.size()) || !files.os.flush())
+        return STATUS_IO_ERROR;
+    return STATUS_OK;
 }
 
+status_code code_in_memory(bool compressing, const char* src, const char* dst, const options& opt)
+{   // Mapped sources are coded in place, output buffers are sized before coding
+    tool_files files { };
+    files.open_input(src, true);
+    files.open_output(dst);
+    std::shared_ptr<std::vector<char>> data;
+    if (!files.input_mapped())
+        data = read_chunk(files.is, ULLONG_MAX);
+    const char* in { data ? data->data() : files.input_map.data() };
+    const size_t in_len { data ? data->size() : files.input_map.size() };
+
+    unsigned long long out_cap { compress_bound(in_len, &opt, opt.block_size) };
+    if (!compressing && huffman_decompressed_size(in, in_len, &out_cap) != HUFFMAN_OK)
+        return STATUS_CORRUPTED;
+    std::vector<char> out(out_cap);
+    size_t out_len;
+    const huffman_status status { compressing ? huffman_compress(in, in_len, out.data(), out.size(), &out_len, &opt, opt.block_size)
+                                              : huffman_decompress(in, in_len, out.data(), out.size(), &out_len, &opt) };
+    if (files.is.bad() || !files.os.write(out.data(), out_len) || !files.os.flush())
+        return STATUS_IO_ERROR;
+    if (status == HUFFMAN_OK)
+        return STATUS_OK;
+    return status == HUFFMAN_CHECKSUM_MISMATCH ? STATUS_CHECKSUM_MISMATCH : STATUS_CORRUPTED;
+}
 
-void compress(const char* src, const char* dst)
+const char* block_name(int type)
 {
-    init_streams(src, dst);
-    if (is_file_empty()) return;
-    huffman_encoder encoder { };
-    encoder.init_for_compressing();
-    buffer_length = 0;
-    process_file(encoder.compress_first_iteration);
-    encoder.encode();
-    encoder.write_header(os);
-    process_file([&](char c)
+    switch (type)
     {
-        write_to_buffer(encoder.compress_second_iteration(c));
-    });
-    flush_buffer();
+    case BLOCK_HUFFMAN: return "huffman";
+    case BLOCK_REUSE: return "reuse";
+    case BLOCK_TANS: return "tans";
+    case BLOCK_STORED: return "stored";
+    case BLOCK_CONTEXT: return "context";
+    case BLOCK_LZ77: return "lz77";
+    }
+    return "unknown";
 }
 
-void decompress(const char* src, const char* dst)
-{
-    init_streams(src, dst);
-    if (is_file_empty()) return;
-    try
-    {
-        huffman_encoder encoder { };
-        if (!encoder.read_header(is))
-        {
-            bad_file();
-        }
-        encoder.init_for_decompressing();
-        process_file([&](char c)
-        {
-            std::vector<char> codes = encoder.decompress_iteration(c);
-            for (char c : codes)
-            {
-                write_char_to_buffer(c);
-            }
-        }, is.cur);
-        if (!is)
-            bad_file();
-        flush_buffer_to_counter();
-    }
-    catch (...)
+status_code list_blocks(const char* src, const char* dst)
+{   // One line per block: its coder, raw size and payload size
+    tool_files files { };
+    files.open_input(src, false);
+    files.open_output(dst);
+    char magic[MAGIC_SIZE];
+    if (files.is.peek() == std::istream::traits_type::eof())     // Empty files have no blocks
+        return STATUS_OK;
+    if (!files.is.read(magic, MAGIC_SIZE) || !std::equal(magic, magic + MAGIC_SIZE, FORMAT_MAGIC))
+        return STATUS_CORRUPTED;
+    decoder_tables tables { };
+    for (block_info block { }; read_block_header(files.is, block, tables); )
     {
-        bad_file();
+        if (block.type == BLOCK_END)
+            return files.os.flush() ? STATUS_OK : STATUS_IO_ERROR;
+        files.os << block_name(block.type) << (block.interleaved ? " interleaved " : " ") << block.raw_size << ' ' << block.payload_size << '\n';
+        if (!files.is.ignore(block.payload_size))
+            break;
     }
+    return STATUS_CORRUPTED;
 }
 
-
 int main(int argc, const char* argv[])
 {
     using namespace std::chrono;
     auto t0 { high_resolution_clock::now() };
 
-    if (argc <= 2 || (strcmp(argv[1], "compress") != 0 && strcmp(argv[1], "decompress") != 0))
+    std::vector<const char*> args;
+    options opt { };
+    bool bad_option { false };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--automaton") == 0)
+            opt.use_automaton = true;
+        else if (strcmp(argv[i], "--stream") == 0)
+            opt.stream = true;
+        else if (strncmp(argv[i], "--max-code-length=", 18) == 0)
+            opt.max_code_length = strtoul(argv[i] + 18, nullptr, 10);
+        else if (strncmp(argv[i], "--block-size=", 13) == 0)
+            opt.block_size = strtoul(argv[i] + 13, nullptr, 10) * 1024;
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            opt.threads = strtoul(argv[i] + 10, nullptr, 10);
+            bad_option |= opt.threads == 0;
+        }
+        else if (strcmp(argv[i], "--shared-table") == 0)
+            opt.shared_table = true;
+        else if (strcmp(argv[i], "--adaptive") == 0)
+            opt.adaptive = true;
+        else if (strcmp(argv[i], "--interleave") == 0)
+            opt.interleave = true;
+        else if (strncmp(argv[i], "--checkpoints=", 14) == 0)
+            opt.checkpoint_interval = strtoul(argv[i] + 14, nullptr, 10) * 1024;
+        else if (strncmp(argv[i], "--offset=", 9) == 0)
+            opt.offset = strtoull(argv[i] + 9, nullptr, 10);
+        else if (strncmp(argv[i], "--length=", 9) == 0)
+            opt.length = strtoull(argv[i] + 9, nullptr, 10);
+        else if (strcmp(argv[i], "--coder=huffman") == 0)
+            opt.coder = CODER_HUFFMAN;
+        else if (strcmp(argv[i], "--coder=tans") == 0)
+            opt.coder = CODER_TANS;
+        else if (strcmp(argv[i], "--coder=context") == 0)
+            opt.coder = CODER_CONTEXT;
+        else if (strcmp(argv[i], "--coder=smallest") == 0)
+            opt.coder = CODER_SMALLEST;
+        else if (strncmp(argv[i], "--lz77=", 7) == 0)
+            opt.lz77_level = strtoul(argv[i] + 7, nullptr, 10);
+        else if (strncmp(argv[i], "--window=", 9) == 0)
+            opt.window = strtoul(argv[i] + 9, nullptr, 10) * 1024;
+        else if (strncmp(argv[i], "--pieces=", 9) == 0)
+        {
+            opt.piece_size = strtoul(argv[i] + 9, nullptr, 10);
+            bad_option |= opt.piece_size == 0;
+        }
+        else if (strcmp(argv[i], "--memory") == 0)
+            opt.memory = true;
+        else if (strncmp(argv[i], "--dictionary=", 13) == 0)
+            opt.dictionary = argv[i] + 13;
+        else if (strncmp(argv[i], "--", 2) == 0)
+            bad_option = true;
+        else
+            args.push_back(argv[i]);
+    }
+    bad_option |= opt.max_code_length == 0 || opt.max_code_length > MAX_CODE_LENGTH;
+    bad_option |= opt.block_size == 0 || opt.block_size > BUFFER_SIZE;
+    bad_option |= opt.checkpoint_interval > BUFFER_SIZE;
+    bad_option |= opt.adaptive && opt.shared_table;
+    bad_option |= opt.shared_table && args.size() > 1 && strcmp(args[1], STANDARD_STREAM) == 0;     // Table is built in a first pass
+    bad_option |= opt.lz77_level > LZ77_MAX_LEVEL || opt.window == 0 || opt.window > BUFFER_SIZE;
+    bad_option |= opt.lz77_level > 0 && (opt.shared_table || opt.adaptive || opt.interleave || opt.coder != CODER_HUFFMAN);
+    bad_option |= opt.piece_size > 0 && (opt.shared_table || opt.adaptive || opt.threads > 0 || opt.offset > 0 || opt.length != ULLONG_MAX);
+    bad_option |= opt.dictionary != nullptr && (opt.piece_size > 0 || opt.shared_table || opt.adaptive || opt.threads > 0 || opt.offset > 0
+                                                || opt.length != ULLONG_MAX || opt.lz77_level > 0);
+    bad_option |= opt.memory && (opt.dictionary != nullptr || opt.piece_size > 0 || opt.shared_table || opt.adaptive || opt.threads > 0
+                                 || opt.offset > 0 || opt.length != ULLONG_MAX);
+
+    const bool listing { args.size() > 0 && strcmp(args[0], "list") == 0 };
+    if (bad_option || args.size() < 2 || (strcmp(args[0], "compress") != 0 && strcmp(args[0], "decompress") != 0 && !listing))
     {
 #if COLOR_SUPPORT == 1
-        printf("\033[1;33mUsage\033[0m: %s [compress|decompress] [source] [destination=%s]\n", argv[0], DEFAULT_FILE);
+        printf("\033[1;33mUsage\033[0m: %s [compress|decompress] [options] [source] [destination=%s]\n", argv[0], DEFAULT_FILE);
+        printf("       %s list [source] [destination=%s]\n", argv[0], STANDARD_STREAM);
 #else
-        printf("Usage: %s [compress|decompress] [source] [destination=%s]\n", argv[0], DEFAULT_FILE);
+        printf("Usage: %s [compress|decompress] [options] [source] [destination=%s]\n", argv[0], DEFAULT_FILE);
+        printf("       %s list [source] [destination=%s]\n", argv[0], STANDARD_STREAM);
 #endif
-        return 0;
+        printf("Options:\n"
+               "  --automaton            decode bit by bit, slow but useful for verification\n"
+               "  --max-code-length=N    limit Huffman codes to N bits, 1 to %u, raised for blocks with more than 2^N byte values\n"
+               "  --stream               read the source once, implied when it is \"%s\"\n"
+               "  --block-size=K         size of blocks in KiB, %u by default\n"
+               "  --threads=N            process blocks in N threads, output doesn't depend on N\n"
+               "  --shared-table         code all blocks with one table, the source must be a file, not \"%s\" or a pipe\n"
+               "  --adaptive             per block, reuse the previous table, build a new one or store bytes\n"
+               "  --interleave           split blocks into %u streams decoded together, faster to decode\n"
+               "  --coder=C              huffman, tans, context (order-1) or smallest per block, huffman by default\n"
+               "  --lz77=L               find repeats first, L from 1 (fast) to %u (small), Huffman codes the rest\n"
+               "  --window=K             distance of repeats in KiB, %u by default, limited by the block size\n"
+               "  --pieces=N             go through the incremental library API N bytes at a time, one thread\n"
+               "  --dictionary=FILE      code the source as one message against a trained table, with no header\n"
+               "  --memory               code the whole source with one library call, from memory to memory\n"
+               "  --checkpoints=K        let decoding start at every K KiB of a block, see --offset\n"
+               "  --offset=N             decompress from byte N, the source must be a file\n"
+               "  --length=N             decompress at most N bytes\n",
+               MAX_CODE_LENGTH, STANDARD_STREAM, DEFAULT_STREAM_BLOCK / 1024, STANDARD_STREAM, STREAM_COUNT, LZ77_MAX_LEVEL, LZ77_DEFAULT_WINDOW / 1024);
+        return STATUS_BAD_USAGE;
     }
 
-    const char* src { argv[2] };
-    const char* dst { (argc > 3) ? argv[3] : DEFAULT_FILE };
+    const char* src { args[1] };
+    const char* dst { (args.size() > 2) ? args[2] : listing ? STANDARD_STREAM : DEFAULT_FILE };
 
-    if (strcmp(src, dst) == 0)
+    if (strcmp(src, dst) == 0 && strcmp(src, STANDARD_STREAM) != 0)
     {
 #if COLOR_SUPPORT == 1
         printf("\033[1;31mError\033[0m: source file matches destination file\n");
 #else
         printf("Error: source file matches destination file\n");
 #endif
-        return 0;
+        return STATUS_BAD_USAGE;
     }
 
-    (strcmp(argv[1], "compress") == 0) ? compress(src, dst) : decompress(src, dst);
+    status_code status { STATUS_OK };
+    try
+    {
+        if (listing)
+            status = list_blocks(src, dst);
+        else if (opt.dictionary != nullptr)
+            status = code_message(strcmp(args[0], "compress") == 0, src, dst, opt);
+        else if (opt.memory)
+            status = code_in_memory(strcmp(args[0], "compress") == 0, src, dst, opt);
+        else if (opt.piece_size > 0)
+            status = code_by_pieces(strcmp(args[0], "compress") == 0, src, dst, opt);
+        else if (strcmp(args[0], "compress") == 0)
+            status = compress(src, dst, opt);
+        else
+            status = decompress(src, dst, opt);
+    }
+    catch (const std::exception& e)
+    {   // Files couldn't be opened or mapped
+        fprintf(stderr, "%s\n", e.what());
+        return STATUS_IO_ERROR;
+    }
+    if (status != STATUS_OK)
+    {
+        fprintf(stderr, "%s\n", status_message(status));
+        return status;
+    }
 
     auto t1 { high_resolution_clock::now() };
 
-    printf("Duration: %ld ms\n", duration_cast<milliseconds>(t1 - t0).count());
+    fprintf(strcmp(dst, STANDARD_STREAM) == 0 ? stderr : stdout, "Duration: %ld ms\n", duration_cast<milliseconds>(t1 - t0).count());
 
     return 0;
 }
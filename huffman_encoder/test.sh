@@ -1,47 +1,243 @@
+out=$(mktemp -d)     # Outputs stay out of samples, which the dictionary test trains on
+trap 'rm -rf "$out"' EXIT
+
 echo "Compressing png"
-./huffman_testing compress samples/picture.png samples/dst.png;
+./huffman_testing compress samples/picture.png $out/dst.png;
 echo "Size of the source file";
 wc -c < "samples/picture.png";
 echo "Size of the compressed file";
-wc -c < "samples/dst.png";
-./huffman_testing decompress samples/dst.png samples/picture2.png;
-./compare.sh samples/picture.png samples/picture2.png;
+wc -c < "$out/dst.png";
+./huffman_testing decompress $out/dst.png $out/picture2.png;
+./compare.sh samples/picture.png $out/picture2.png;
 echo
 echo "Compressing empty file"
-./huffman_testing compress samples/empty.txt samples/dst.txt;
+./huffman_testing compress samples/empty.txt $out/dst.txt;
 echo "Size of the source file";
 wc -c < "samples/empty.txt";
 echo "Size of the compressed file";
-wc -c < "samples/dst.txt";
-./huffman_testing decompress samples/dst.txt samples/empty2.txt;
-./compare.sh samples/empty.txt samples/empty2.txt;
+wc -c < "$out/dst.txt";
+./huffman_testing decompress $out/dst.txt $out/empty2.txt;
+./compare.sh samples/empty.txt $out/empty2.txt;
 echo
 echo "Compressing lorem ipsum file"
-./huffman_testing compress samples/lorem.txt samples/dst.txt;
+./huffman_testing compress samples/lorem.txt $out/dst.txt;
 echo "Size of the source file";
 wc -c < "samples/lorem.txt";
 echo "Size of the compressed file";
-wc -c < "samples/dst.txt";
-./huffman_testing decompress samples/dst.txt samples/lorem2.txt;
-./compare.sh samples/lorem.txt samples/lorem2.txt;
+wc -c < "$out/dst.txt";
+./huffman_testing decompress $out/dst.txt $out/lorem2.txt;
+./compare.sh samples/lorem.txt $out/lorem2.txt;
 echo
 echo "Trying to decompress corrupted file"
-./huffman_testing decompress samples/random.txt samples/random2.txt;
+./huffman_testing decompress samples/random.txt $out/random2.txt;
 echo
 echo "Compressing War and Peace.txt"
-./huffman_testing compress samples/Warandpeace.txt samples/dst.txt;
+./huffman_testing compress samples/Warandpeace.txt $out/dst.txt;
 echo "Size of the source file";
 wc -c < "samples/Warandpeace.txt";
 echo "Size of the compressed file";
-wc -c < "samples/dst.txt";
-./huffman_testing decompress samples/dst.txt samples/Warandpeace2.txt;
-./compare.sh samples/Warandpeace.txt samples/Warandpeace2.txt;
+wc -c < "$out/dst.txt";
+./huffman_testing decompress $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
 echo
 echo "Compressing War and Peace.pdf"
-./huffman_testing compress samples/Warandpeace.pdf samples/dst.pdf;
+./huffman_testing compress samples/Warandpeace.pdf $out/dst.pdf;
 echo "Size of the source file";
 wc -c < "samples/Warandpeace.pdf";
 echo "Size of the compressed file";
-wc -c < "samples/dst.pdf";
-./huffman_testing decompress samples/dst.pdf samples/Warandpeace2.pdf;
-./compare.sh samples/Warandpeace.pdf samples/Warandpeace2.pdf;
+wc -c < "$out/dst.pdf";
+./huffman_testing decompress $out/dst.pdf $out/Warandpeace2.pdf;
+./compare.sh samples/Warandpeace.pdf $out/Warandpeace2.pdf;
+echo
+echo "Decompressing War and Peace.txt with bit-at-a-time automaton"
+./huffman_testing compress samples/Warandpeace.txt $out/dst.txt;
+./huffman_testing decompress --automaton $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+echo
+echo "Compressing War and Peace.pdf with codes limited to 11 bits"
+./huffman_testing compress --max-code-length=11 samples/Warandpeace.pdf $out/dst.pdf;
+echo "Size of the compressed file";
+wc -c < "$out/dst.pdf";
+./huffman_testing decompress $out/dst.pdf $out/Warandpeace2.pdf;
+./compare.sh samples/Warandpeace.pdf $out/Warandpeace2.pdf;
+echo
+echo "Compressing Fibonacci-like counts, whose longest code of 19 bits is limited to 8"
+awk 'BEGIN { a = 1; b = 1; for (i = 0; i < 20; ++i) { for (k = 0; k < a; ++k) printf "%c", 65 + i; t = a + b; a = b; b = t } }' > $out/dst2.txt;
+./huffman_testing compress $out/dst2.txt $out/dst.txt;
+./huffman_testing compress --max-code-length=8 $out/dst2.txt $out/dst.pdf;
+echo "Limit and longest code in the headers, without and with the limit";
+od -An -tu1 -j14 -N4 $out/dst.txt | awk '{ print $1, $4 }';
+od -An -tu1 -j14 -N4 $out/dst.pdf | awk '{ print $1, $4 }';
+[ "$(od -An -tu1 -j17 -N1 $out/dst.pdf)" -eq 8 ] && echo "OK" || echo "Something changed";
+./huffman_testing decompress $out/dst.pdf $out/Warandpeace2.txt;
+./compare.sh $out/dst2.txt $out/Warandpeace2.txt;
+echo
+echo "Compressing War and Peace.txt from a pipe in 64 KiB blocks"
+cat samples/Warandpeace.txt | ./huffman_testing compress --block-size=64 - $out/dst.txt;
+echo "Size of the compressed file";
+wc -c < "$out/dst.txt";
+./huffman_testing decompress $out/dst.txt - > $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+echo
+echo "Compressing picture.png in 4 threads, output must match the single-threaded one"
+./huffman_testing compress --threads=4 samples/picture.png $out/dst.png;
+./huffman_testing compress --threads=1 samples/picture.png $out/dst2.png;
+./compare.sh $out/dst.png $out/dst2.png;
+./huffman_testing decompress --threads=4 $out/dst.png $out/picture2.png;
+./compare.sh samples/picture.png $out/picture2.png;
+echo
+echo "Compressing War and Peace.txt in 64 KiB blocks mapped, in 1 and 4 threads and from a pipe, outputs must match"
+./huffman_testing compress --block-size=64 samples/Warandpeace.txt $out/dst.txt;
+./huffman_testing compress --block-size=64 --threads=1 samples/Warandpeace.txt $out/dst2.txt;
+./compare.sh $out/dst.txt $out/dst2.txt;
+./huffman_testing compress --block-size=64 --threads=4 samples/Warandpeace.txt $out/dst2.txt;
+./compare.sh $out/dst.txt $out/dst2.txt;
+cat samples/Warandpeace.txt | ./huffman_testing compress --block-size=64 - $out/dst2.txt;
+./compare.sh $out/dst.txt $out/dst2.txt;
+echo
+echo "Compressing War and Peace.txt with one table shared by all blocks"
+./huffman_testing compress --shared-table --threads=4 --block-size=256 samples/Warandpeace.txt $out/dst.txt;
+echo "Size of the compressed file";
+wc -c < "$out/dst.txt";
+./huffman_testing decompress --threads=4 $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+echo
+echo "Compressing a pipe with one shared table, which needs a second pass over the source, is refused"
+cat samples/lorem.txt | ./huffman_testing compress --shared-table - $out/pipe.huf > /dev/null;
+[ $? -eq 1 ] && echo "OK" || echo "Something changed";
+cat samples/lorem.txt | ./huffman_testing compress --shared-table --threads=2 /dev/stdin $out/pipe.huf 2> /dev/null;
+[ $? -eq 2 ] && [ ! -e $out/pipe.huf ] && echo "OK" || echo "Something changed";
+echo
+echo "Compressing picture.png to standard output, output must match the mapped file"
+./huffman_testing compress samples/picture.png $out/dst.png;
+./huffman_testing compress samples/picture.png - > $out/dst2.png 2> /dev/null;
+./compare.sh $out/dst.png $out/dst2.png;
+./huffman_testing decompress $out/dst2.png $out/picture2.png;
+./compare.sh samples/picture.png $out/picture2.png;
+echo
+echo "Decompressing ranges of War and Peace.txt in 64 KiB blocks through checkpoints every 16 KiB"
+./huffman_testing compress --checkpoints=16 --block-size=64 --threads=2 samples/Warandpeace.txt $out/dst.txt;
+echo "Number of blocks";
+./huffman_testing list $out/dst.txt 2> /dev/null | wc -l;
+for range in 1000000:50000 65530:20 16380:100000 0:16384 196600:70000 1473000:10000; do
+    ./huffman_testing decompress --offset=${range%:*} --length=${range#*:} $out/dst.txt $out/Warandpeace2.txt > /dev/null;
+    tail -c +$((${range%:*} + 1)) samples/Warandpeace.txt | head -c ${range#*:} > $out/dst2.txt;
+    ./compare.sh $out/dst2.txt $out/Warandpeace2.txt;
+done
+echo
+echo "Compressing War and Peace.txt in 4 interleaved streams per block"
+./huffman_testing compress --interleave --block-size=256 --threads=4 --checkpoints=16 samples/Warandpeace.txt $out/dst.txt;
+echo "Size of the compressed file";
+wc -c < "$out/dst.txt";
+echo "Number of blocks";
+./huffman_testing list $out/dst.txt 2> /dev/null | wc -l;
+./huffman_testing decompress $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+./huffman_testing decompress --threads=4 $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+./huffman_testing decompress --automaton $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+echo "Ranges across streams of a block and across blocks";
+for range in 60000:10000 130000:70000 250000:20000 500000:300000; do
+    ./huffman_testing decompress --offset=${range%:*} --length=${range#*:} $out/dst.txt $out/Warandpeace2.txt > /dev/null;
+    tail -c +$((${range%:*} + 1)) samples/Warandpeace.txt | head -c ${range#*:} > $out/dst2.txt;
+    ./compare.sh $out/dst2.txt $out/Warandpeace2.txt;
+done
+echo
+echo "Compressing text, random bytes and picture.png with the smallest coder per block, blocks must differ in coders"
+cat samples/Warandpeace.txt samples/random.txt samples/picture.png > $out/mixed.txt;
+./huffman_testing compress --coder=smallest --threads=4 --block-size=256 $out/mixed.txt $out/dst.png;
+echo "Size of the compressed file";
+wc -c < "$out/dst.png";
+echo "Coders of the blocks";
+./huffman_testing list $out/dst.png 2> /dev/null | cut -d' ' -f1 | sort | uniq -c;
+[ "$(./huffman_testing list $out/dst.png 2> /dev/null | cut -d' ' -f1 | sort -u | wc -l)" -gt 1 ] && echo "OK" || echo "Something changed";
+./huffman_testing decompress --threads=4 $out/dst.png $out/picture2.png;
+./compare.sh $out/mixed.txt $out/picture2.png;
+./huffman_testing compress --coder=tans samples/Warandpeace.txt $out/dst.txt;
+./huffman_testing decompress $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+echo
+echo "Compressing War and Peace.pdf choosing a new table, the previous one or stored bytes per block"
+./huffman_testing compress --adaptive --threads=4 --block-size=64 samples/Warandpeace.pdf $out/dst.pdf;
+echo "Size of the compressed file";
+wc -c < "$out/dst.pdf";
+./huffman_testing decompress --threads=4 $out/dst.pdf $out/Warandpeace2.pdf;
+./compare.sh samples/Warandpeace.pdf $out/Warandpeace2.pdf;
+./huffman_testing decompress $out/dst.pdf $out/Warandpeace2.pdf;
+./compare.sh samples/Warandpeace.pdf $out/Warandpeace2.pdf;
+echo
+echo "Compressing War and Peace.txt with order-1 tables selected by the previous byte"
+./huffman_testing compress --coder=context samples/Warandpeace.txt $out/dst.txt;
+echo "Size of the compressed file";
+wc -c < "$out/dst.txt";
+./huffman_testing decompress $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+./huffman_testing compress --coder=context --block-size=128 --threads=4 samples/Warandpeace.txt $out/dst.txt;
+./huffman_testing decompress --threads=4 $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+echo
+echo "Compressing War and Peace.txt with LZ77 matches ahead of the Huffman stage"
+./huffman_testing compress --lz77=6 --block-size=4096 samples/Warandpeace.txt $out/dst.txt;
+echo "Size of the compressed file";
+wc -c < "$out/dst.txt";
+./huffman_testing decompress $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+./huffman_testing compress --lz77=1 --threads=4 --block-size=256 --window=64 samples/Warandpeace.pdf $out/dst.pdf;
+./huffman_testing decompress --threads=4 $out/dst.pdf $out/Warandpeace2.pdf;
+./compare.sh samples/Warandpeace.pdf $out/Warandpeace2.pdf;
+echo
+echo "Compressing random.txt, which coding would only expand, into a stored block"
+./huffman_testing compress samples/random.txt $out/dst.txt;
+echo "Size of the compressed file";
+wc -c < "$out/dst.txt";
+./huffman_testing decompress $out/dst.txt $out/random2.txt;
+./compare.sh samples/random.txt $out/random2.txt;
+echo
+echo "Decompressing a stored block with one byte changed, which only its checksum reveals"
+./huffman_testing compress samples/random.txt $out/dst.txt;
+printf 'x' | dd of=$out/dst.txt bs=1 seek=100 conv=notrunc 2> /dev/null;
+./huffman_testing decompress $out/dst.txt $out/random2.txt;
+[ $? -eq 4 ] && echo "OK" || echo "Something changed";
+echo
+echo "Decompressing all of a Huffman block with one byte changed as a range, its checksum is still verified"
+./huffman_testing compress samples/lorem.txt $out/dst.txt;
+printf 'x' | dd of=$out/dst.txt bs=1 seek=300 conv=notrunc 2> /dev/null;
+./huffman_testing decompress --offset=0 --length=100000 $out/dst.txt $out/lorem2.txt;
+[ $? -eq 4 ] && echo "OK" || echo "Something changed";
+echo
+echo "Decompressing a tANS block which claims more than the largest block, it's rejected before decoding"
+./huffman_testing compress --coder=tans samples/lorem.txt $out/dst.txt;
+printf '\377\377\377\177' | dd of=$out/dst.txt bs=1 seek=5 conv=notrunc 2> /dev/null;
+./huffman_testing decompress --pieces=100 $out/dst.txt $out/lorem2.txt;
+[ $? -eq 3 ] && echo "OK" || echo "Something changed";
+echo
+echo "Compressing War and Peace.txt through the incremental API of the library"
+./huffman_testing compress --pieces=4096 --block-size=256 --coder=smallest samples/Warandpeace.txt $out/dst.txt;
+./huffman_testing decompress --pieces=1000 $out/dst.txt $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+echo
+echo "Piping War and Peace.txt through the tool, reading, coding and writing overlap"
+cat samples/Warandpeace.txt | ./huffman_testing compress --threads=4 --block-size=4096 - - | ./huffman_testing decompress --threads=4 - $out/Warandpeace2.txt;
+./compare.sh samples/Warandpeace.txt $out/Warandpeace2.txt;
+echo
+echo "Coding the last 200 bytes of War and Peace.txt as a message against a dictionary trained on it, no header is written"
+./huffman_train --id=1 $out/dst.hud samples/Warandpeace.txt;
+tail -c 200 samples/Warandpeace.txt > $out/dst.txt;
+./huffman_testing compress --dictionary=$out/dst.hud $out/dst.txt $out/dst.pdf;
+echo "Size of the message";
+wc -c < "$out/dst.pdf";
+./huffman_testing decompress --dictionary=$out/dst.hud $out/dst.pdf $out/dst2.txt;
+./compare.sh $out/dst.txt $out/dst2.txt;
+echo
+echo "Training a dictionary on the samples directory in 4 threads, then coding the first 200 bytes of lorem.txt with it"
+./huffman_train --threads=4 --smoothing=100 --max-code-length=16 $out/dst.hud samples;
+head -c 200 samples/lorem.txt > $out/dst.txt;
+./huffman_testing compress --dictionary=$out/dst.hud $out/dst.txt $out/dst.pdf;
+./huffman_testing decompress --dictionary=$out/dst.hud $out/dst.pdf $out/dst2.txt;
+./compare.sh $out/dst.txt $out/dst2.txt;
+echo
+echo "Compressing Warandpeace.pdf with one library call from memory to memory"
+./huffman_testing compress --memory --interleave --block-size=256 samples/Warandpeace.pdf $out/dst.pdf;
+./huffman_testing decompress --memory $out/dst.pdf $out/Warandpeace2.pdf;
+./compare.sh samples/Warandpeace.pdf $out/Warandpeace2.pdf;
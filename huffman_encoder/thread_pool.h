@@ -0,0 +1,75 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+struct thread_pool
+{
+    explicit thread_pool(unsigned threads)
+    {
+        for (unsigned i = 0; i < threads; ++i)
+            workers.emplace_back([this] { work(); });
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock { m };
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& w : workers) { w.join(); }
+    }
+
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> submit(F f)
+    {   // Exceptions thrown by the task are rethrown by the future
+        using result = typename std::result_of<F()>::type;
+        auto task = std::make_shared<std::packaged_task<result()>>(std::move(f));
+        std::future<result> res { task->get_future() };
+        {
+            std::lock_guard<std::mutex> lock { m };
+            tasks.push([task] { (*task)(); });
+        }
+        cv.notify_one();
+        return res;
+    }
+
+    size_t size() const { return workers.size(); }
+
+private:
+    void work()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock { m };
+                cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers { };
+    std::queue<std::function<void()>> tasks { };
+    std::mutex m { };
+    std::condition_variable cv { };
+    bool stopping { false };
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,147 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "huffman_encoder.h"
+#include "histogram.h"
+#include "thread_pool.h"
+#include "dictionary.h"
+
+// Trains a dictionary on sample files, messages like them are then coded with --dictionary of huffman_testing
+
+constexpr unsigned SAMPLE_CHUNK { 1024 * 1024 };    // Samples are counted by pieces of this size
+
+void collect_files(const std::string& path, std::vector<std::string>& files)
+{   // Directories are scanned recursively, entries which are neither files nor directories are skipped
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        throw std::runtime_error { "Couldn't read " + path };
+    if (S_ISREG(info.st_mode))
+    {
+        files.push_back(path);
+        return;
+    }
+    if (!S_ISDIR(info.st_mode))
+        return;
+    DIR* dir { opendir(path.c_str()) };
+    if (dir == nullptr)
+        throw std::runtime_error { "Couldn't read " + path };
+    std::vector<std::string> entries;
+    for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            entries.push_back(path + "/" + entry->d_name);
+    }
+    closedir(dir);
+    for (const std::string& entry : entries)
+        collect_files(entry, files);
+}
+
+void count_file(const std::string& path, std::vector<char>& buffer, histogram& counts)
+{
+    std::ifstream in { path, std::ios_base::in | std::ios_base::binary };
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+        counts.add(buffer.data(), static_cast<size_t>(in.gcount()));
+    if (!in.eof() || in.bad())
+        throw std::runtime_error { "Couldn't read " + path };
+}
+
+histogram count_files(const std::vector<std::string>& files, unsigned threads)
+{   // Every thread takes the next file once it is done with one, so large files don't hold the others up
+    std::atomic<size_t> next { 0 };     // Outlives the pool, which finishes its tasks even after a failure
+    thread_pool pool { threads };
+    std::vector<std::future<histogram>> parts;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        parts.push_back(pool.submit([&files, &next]
+        {
+            histogram counts { };
+            std::vector<char> buffer(SAMPLE_CHUNK);
+            for (size_t i = next++; i < files.size(); i = next++)
+                count_file(files[i], buffer, counts);
+            return counts;
+        }));
+    }
+    histogram res { };
+    for (auto& part : parts)
+        res.merge(part.get());
+    return res;
+}
+
+int main(int argc, const char* argv[])
+{
+    std::vector<const char*> args;
+    unsigned long long id { 0 };
+    unsigned max_code_length { MAX_CODE_LENGTH };
+    unsigned long long smoothing { DEFAULT_SMOOTHING };
+    unsigned threads { std::max(std::thread::hardware_concurrency(), 1u) };
+    bool bad_option { false };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strncmp(argv[i], "--id=", 5) == 0)
+            id = strtoull(argv[i] + 5, nullptr, 10);
+        else if (strncmp(argv[i], "--max-code-length=", 18) == 0)
+            max_code_length = strtoul(argv[i] + 18, nullptr, 10);
+        else if (strncmp(argv[i], "--smoothing=", 12) == 0)
+        {
+            smoothing = strtoull(argv[i] + 12, nullptr, 10);
+            bad_option |= smoothing == 0;
+        }
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            threads = strtoul(argv[i] + 10, nullptr, 10);
+            bad_option |= threads == 0;
+        }
+        else if (strncmp(argv[i], "--", 2) == 0)
+            bad_option = true;
+        else
+            args.push_back(argv[i]);
+    }
+    bad_option |= id > UINT32_MAX || max_code_length == 0 || max_code_length > MAX_CODE_LENGTH;
+
+    if (bad_option || args.size() < 2)
+    {
+        printf("Usage: %s [options] [dictionary] [samples...]\n", argv[0]);
+        printf("Options:\n"
+               "  --id=N                 ID of the dictionary, up to %u, 0 by default\n"
+               "  --max-code-length=N    limit Huffman codes to N bits, 1 to %u, raised to 8 as every byte value gets a code\n"
+               "  --smoothing=N          add N to the count of every byte value, so unseen ones get codes, %llu by default\n"
+               "  --threads=N            count samples in N threads, one per core by default\n"
+               "Samples are files or directories, which are scanned recursively\n",
+               UINT32_MAX, MAX_CODE_LENGTH, DEFAULT_SMOOTHING);
+        return 1;
+    }
+
+    histogram counts { };
+    std::vector<std::string> files;
+    try
+    {
+        for (size_t i = 1; i < args.size(); ++i)
+            collect_files(args[i], files);
+        counts = count_files(files, threads);
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+    const std::shared_ptr<huffman_dictionary> dict { train_dictionary(counts, static_cast<uint32_t>(id), max_code_length, smoothing) };
+    std::ofstream out { args[0], std::ios_base::out | std::ios_base::trunc | std::ios_base::binary };
+    write_dictionary(out, *dict);
+    if (!out.flush())
+    {
+        fprintf(stderr, "Couldn't write %s\n", args[0]);
+        return 2;
+    }
+    printf("Dictionary %u trained on %zu files, %llu bytes\n", dict->id, files.size(), counts.total);
+    return 0;
+}